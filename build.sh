@@ -4,11 +4,12 @@ set -xe
 
 CFLAGS="-Wall -Wextra -Werror -pedantic -ggdb `pkg-config --cflags sdl2` -Wno-unused-function -Wno-error=unused-variable -Wno-error=unused-parameter"
 #CFLAGS="-ggdb `pkg-config --cflags sdl2`"
-LIBS="`pkg-config --libs sdl2`"
+LIBS="`pkg-config --libs sdl2` -lm"
 
 clang $CFLAGS -O3 -o gb $LIBS gb_sdl.c gb.c
 clang $CFLAGS -O3 -o gb_headless $LIBS gb_headless.c gb.c
-clang $CFLAGS -o test gb_test.c gb.c
+clang $CFLAGS -O3 -o gb_batch gb_batch.c gb.c -lm -pthread
+clang $CFLAGS -o test gb_test.c gb.c -lm -pthread
 
 if ! command -v rgbasm &> /dev/null
 then
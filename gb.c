@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,11 +13,9 @@
 const Color PALETTE[] = {0xE0F8D0FF, 0x88C070FF, 0x346856FF, 0x081820FF};
 //const Color PALETTE[] = {0xFFFFFFFF, 0xC0C0C0FF, 0x404040FF, 0x000000FF};
 
-static int gb_clock_freq(int clock_select)
-{
-    int freq[] = {4096, 262144, 65536, 16384};
-    return freq[clock_select & 3];
-}
+// TIMA is incremented on the falling edge of this bit of the internal divider
+// 4096 Hz, 262144 Hz, 65536 Hz, 16384 Hz
+static const u16 TAC_DIV_BIT[4] = {1 << 9, 1 << 3, 1 << 5, 1 << 7};
 
 
 #define make_inst1(b0)         make_inst_internal(1, b0, -1, -1)
@@ -34,7 +33,13 @@ static Inst make_inst_internal(u8 n, u8 b0, u8 b1, u8 b2)
     return inst;
 }
 
-Inst gb_fetch_internal(const u8 *data, u8 flags, bool exit_illegal_inst)
+bool gb_is_illegal_opcode(u8 b)
+{
+    return b == 0xd3 || b == 0xdb || b == 0xdd || b == 0xe3 || b == 0xe4 ||
+           b == 0xeb || b == 0xec || b == 0xed || b == 0xf4 || b == 0xfc || b == 0xfd;
+}
+
+Inst gb_fetch_internal(const u8 *data, u8 flags)
 {
     u8 b = data[0];
     u8 z = (flags >> 7) & 1;
@@ -42,16 +47,9 @@ Inst gb_fetch_internal(const u8 *data, u8 flags, bool exit_illegal_inst)
     u8 cc = (b >> 3) & 3; // 0 -> Z=0 | 1 -> Z=1 | 2 -> C=0 | 3 -> C=1
     bool taken = (cc == 0 && z == 0) || (cc == 1 && z == 1) || (cc == 2 && c == 0) || (cc == 3 && c == 1);
 
-    if (b == 0xd3 || b == 0xdb || b == 0xdd || b == 0xe3 || b == 0xe4 ||
-        b == 0xeb || b == 0xec || b == 0xed || b == 0xf4 || b == 0xfc || b == 0xfd)
-    {
-        //gb_dump(gb);
-        if (exit_illegal_inst) {
-            fprintf(stderr, "Illegal Instruction 0x%02X\n", b);
-            exit(1);
-        } else {
-            return (Inst){.data = {b}, .size = 1};
-        }
+    // Executing one of these locks up the CPU (see gb_exec)
+    if (gb_is_illegal_opcode(b)) {
+        return (Inst){.data = {b}, .size = 1};
     }
 
     // 1-byte instructions
@@ -150,7 +148,7 @@ Inst gb_fetch_internal(const u8 *data, u8 flags, bool exit_illegal_inst)
 
 Inst gb_fetch(const GameBoy *gb)
 {
-    return gb_fetch_internal(gb->memory + gb->PC, gb->F, false);
+    return gb_fetch_internal(gb->memory + gb->PC, gb->F);
 }
 
 const char *gb_decode(Inst inst, char *buf, size_t size)
@@ -402,6 +400,9 @@ int gb_exec(GameBoy *gb, Inst inst)
         gb->boot_mode = false;
     }
 
+    // Only a reset gets the CPU out of an illegal opcode lock-up
+    if (gb->status == GB_STATUS_ILLEGAL_OP) return -1;
+
     if (gb->stopped) {
         if (gb_button_down(gb)) {
             gb->stopped = false;
@@ -485,6 +486,11 @@ int gb_exec(GameBoy *gb, Inst inst)
     int cycles = inst.cycles;
 
     u8 b = inst.data[0];
+    if (gb_is_illegal_opcode(b)) {
+        gb->status = GB_STATUS_ILLEGAL_OP;
+        return -1;
+    }
+
     // 1-byte instructions
     if (inst.size == 1) {
         if (b == 0x00) {
@@ -809,14 +815,14 @@ int gb_exec(GameBoy *gb, Inst inst)
             gb_log_inst("STOP");
             gb->stopped = true;
         } else if (b == 0x18) {
-            static bool infinite_loop = false;
+            bool infinite_loop = gb->infinite_loop;
             int r8 = inst.data[1] >= 0x80 ? (int8_t)inst.data[1] : inst.data[1];
             if (!infinite_loop) {
                 gb_log_inst("JR %d", r8);
             }
             if (r8 == -2 && !infinite_loop) {
                 //fprintf(stderr, "Detected infinite loop...\n");
-                //infinite_loop = true;
+                //gb->infinite_loop = true;
             }
             gb->PC = (gb->PC + inst.size) + r8;
         } else if ( // LD reg,d8
@@ -829,14 +835,14 @@ int gb_exec(GameBoy *gb, Inst inst)
             gb->PC += inst.size;
         } else if (b == 0x20 || b == 0x30 || b == 0x28 || b == 0x38) {
             Flag f = (b >> 3) & 0x3;
-            static bool infinite_loop = false;
+            bool infinite_loop = gb->infinite_loop;
             if (!infinite_loop) {
                 gb_log_inst("JR %s,0x%02X", gb_flag_to_str(f), inst.data[1]);
             }
             if (gb_get_flag(gb, f)) {
                 int offset = inst.data[1] >= 0x80 ? (int8_t)inst.data[1] : inst.data[1];
                 if (offset == -2 && !infinite_loop) {
-                    //infinite_loop = true;
+                    //gb->infinite_loop = true;
                     //printf("Detected infinite loop...\n");
                 }
                 gb->PC = (gb->PC + inst.size) + offset;
@@ -1026,13 +1032,13 @@ int gb_exec(GameBoy *gb, Inst inst)
     else if (inst.size == 3) {
         u16 n = inst.data[1] | (inst.data[2] << 8);
         if (b == 0xC3) {
-            static bool infinite_loop = false;
+            bool infinite_loop = gb->infinite_loop;
             if (!infinite_loop) {
                 gb_log_inst("JP 0x%04X", n);
             }
             if (n == gb->PC && !infinite_loop) {
                 //printf("Detected infinite loop...\n");
-                //infinite_loop = true;
+                //gb->infinite_loop = true;
             }
             gb->PC = n;
         } else if (b == 0x01 || b == 0x11 || b == 0x21 || b == 0x31) {
@@ -1091,225 +1097,165 @@ int gb_exec(GameBoy *gb, Inst inst)
     return cycles;
 }
 
-static size_t gb_tile_coord_to_pixel(int row, int col)
-{
-    assert(row >= 0 && row < 32);
-    assert(col >= 0 && col < 32);
-    int row_pixel = row*TILE_PIXELS; // (0, 8, 16, ..., 248)
-    int col_pixel = col*TILE_PIXELS; // (0, 8, 16, ..., 248)
-    return row_pixel*SCRN_VX + col_pixel;
-}
+// Bit-reversed bytes, used to flip a row of tile data horizontally
+#define R2(n) (n), (n) + 2*64, (n) + 1*64, (n) + 3*64
+#define R4(n) R2(n), R2((n) + 2*16), R2((n) + 1*16), R2((n) + 3*16)
+#define R6(n) R4(n), R4((n) + 2*4), R4((n) + 1*4), R4((n) + 3*4)
+static const u8 REVERSE_BITS[256] = { R6(0), R6(2), R6(1), R6(3) };
+#undef R6
+#undef R4
+#undef R2
 
-static void fill_solid_tile(GameBoy *gb, int x, int y, Color color)
-{
-    for (int row = 0; row < 8; row++) {
-        for (int col = 0; col < 8; col++) {
-            gb->display[(row+y)*256 + (col+x)] = color;
-        }
-    }
-}
+#define OBJ_LINE_PALETTE 0x10 // OBP1 selected
+#define OBJ_LINE_BEHIND  0x80 // BG/Win colors 1-3 are drawn over the object
 
-// Render Heart tile at 0,0
-//u8 tile[] = {
-//    0x00, 0x00, 0x6C, 0x6C, 0xFE, 0xFA, 0xFE, 0xFE,
-//    0xFE, 0xFE, 0x7C, 0x7C, 0x38, 0x38, 0x10, 0x10,
-//};
-//fill_tile(gb, 0, 0, tile);
-// x - pixel coordinate
-// y - pixel coordinate
-static void fill_tile(GameBoy *gb, int x, int y, u8 *tile, bool transparency, u8 plt)
-{
-    // tile is 16 bytes
-    //u8 bgp = gb->memory[rBGP];
-    u8 bgp = plt;
-    u8 bgp_tbl[] = {(bgp >> 0) & 3, (bgp >> 2) & 3, (bgp >> 4) & 3, (bgp >> 6) & 3};
-    for (int row = 0; row < 8; row++) {
-        // 64 pixels, but only 16 bytes (2 bytes per row)
-        u8 low_bitplane = tile[row*2+0];
-        u8 high_bitplane = tile[row*2+1];
-        for (int col = 0; col < 8; col++) {
-            u8 bit0 = (low_bitplane & 0x80) >> 7;
-            u8 bit1 = (high_bitplane & 0x80) >> 7;
-            low_bitplane <<= 1;
-            high_bitplane <<= 1;
-            u8 color_idx = (bit1 << 1) | bit0; // 0-3
-            u8 palette_idx = bgp_tbl[color_idx];
-            Color color = PALETTE[palette_idx];
-            if (!transparency || color_idx != 0) {
-                int r = (row+y) % 256;
-                int c = (col+x) % 256;
-                gb->display[r*256 + c] = color;
-            }
-        }
-    }
-}
-
-static u8 flip_horz(u8 b)
-{
-    // 01234567 => 7654321
-    return 0 |
-        (((b >> 0) & 1) << 7) |
-        (((b >> 1) & 1) << 6) |
-        (((b >> 2) & 1) << 5) |
-        (((b >> 3) & 1) << 4) |
-        (((b >> 4) & 1) << 3) |
-        (((b >> 5) & 1) << 2) |
-        (((b >> 6) & 1) << 1) |
-        (((b >> 7) & 1) << 0);
-}
-
-static void flip_vert(u8 *tile)
+// Returns the 2 bitplanes (low in bits 0-7, high in bits 8-15) of the tile row
+// under pixel (x, y) of the 256x256 tilemap at tm_off
+static u16 gb_fetch_tile_row(const GameBoy *gb, u16 tm_off, u8 lcdc, u8 x, u8 y)
 {
-    for (int i = 0; i < 4; i++) {
-        u8 t = tile[2*i+0];
-        tile[2*i+0] = tile[14-2*i];
-        tile[14-2*i] = t;
-
-        t = tile[2*i+1];
-        tile[2*i+1] = tile[14-(2*i)+1];
-        tile[14-(2*i)+1] = t;
+    int tile_idx = gb->memory[tm_off + (y / 8)*32 + (x / 8)];
+    u16 td_off = _VRAM8000;
+    if ((lcdc & LCDCF_BG8000) != LCDCF_BG8000) {
+        td_off = _VRAM9000;
+        tile_idx = (int8_t)tile_idx;
     }
+    const u8 *tile_row = gb->memory + td_off + tile_idx*16 + (y % 8)*2;
+    return tile_row[0] | (tile_row[1] << 8);
 }
 
-static void dump_tile(u8 *tile)
+// Color index (0-3) of pixel x (0-7, left to right) of a tile row
+static u8 gb_tile_row_color_idx(u16 tile_row, int x)
 {
-    for (int i = 0; i < 8; i++) {
-        printf("%02X %02X\n", tile[i*2+0], tile[i*2+1]);
-    }
+    u8 bit0 = (tile_row >> (7 - x)) & 1;
+    u8 bit1 = (tile_row >> (15 - x)) & 1;
+    return (bit1 << 1) | bit0;
 }
 
-static void gb_render_row(GameBoy *gb, int px_row)
+// Paints the objects selected by the OAM scan into obj_line (one entry per pixel).
+// Objects are drawn back to front so that each pixel ends up with the opaque pixel
+// of the object with the highest priority.
+static void gb_render_sprites(const GameBoy *gb, int ly, u8 *obj_line)
 {
     u8 lcdc = gb->memory[rLCDC];
-    if (
-        (lcdc & LCDCF_ON)   != LCDCF_ON ||
-        (lcdc & LCDCF_BGON) != LCDCF_BGON
-    ) {
-        Color color = 0xFFFFFFFF;
-        for (int px_col = 0; px_col < 256; px_col++) {
-            gb->display[px_row*256 + px_col] = color;
-        }
-        return;
-    }
-
-    u16 scx = gb->memory[rSCX];
-    u16 scy = gb->memory[rSCY];
-    (void)scx;
-    (void)scy;
-
-    u16 bg_win_td_off = (lcdc & LCDCF_BG8000) == LCDCF_BG8000 ?  _VRAM8000 : _VRAM9000;
-    u16 bg_tm_off = (lcdc & LCDCF_BG9C00) == LCDCF_BG9C00 ? _SCRN1 : _SCRN0;
-
-    u8 bgp = gb->memory[rBGP];
-    u8 bgp_tbl[] = {(bgp >> 0) & 3, (bgp >> 2) & 3, (bgp >> 4) & 3, (bgp >> 6) & 3};
-
-    int tile_row = px_row / 8; // 0-31
-    for (int px_col = 0; px_col < 256; px_col++) {
-        //px_col = (px_col+scx) % 256;
-        int tile_col = px_col / 8; // 0-31
+    int obj_h = (lcdc & LCDCF_OBJ16) ? 16 : 8;
 
-        int tile_idx = gb->memory[bg_tm_off + tile_row*32 + tile_col]; // 0-383
-        if (bg_win_td_off == _VRAM9000) tile_idx = (int8_t)tile_idx;
+    const PPU *ppu = &gb->ppu;
+    for (int n = ppu->line_obj_count - 1; n >= 0; n--) {
+        const u8 *obj = gb->memory + _OAMRAM + ppu->line_objs[n]*4;
+        int x = obj[1] - 8;
+        u8 tile_idx = obj[2];
+        u8 attribs  = obj[3];
 
-        u8 *tile = gb->memory + bg_win_td_off + tile_idx*16; // 8x8 pixels (16-bytes)
-
-        u8 char_row = px_row % 8; // 0-7
-        u8 low_bitplane  = tile[char_row*2+0];
-        u8 high_bitplane = tile[char_row*2+1];
+        u8 bg_win_over = (attribs >> 7) & 1;
+        u8 yflip = (attribs >> 6) & 1;
+        u8 xflip = (attribs >> 5) & 1;
+        u8 plt_idx = (attribs >> 4) & 1;
 
-        u8 bit0 = (low_bitplane  >> (7 - (px_col % 8))) & 1;
-        u8 bit1 = (high_bitplane >> (7 - (px_col % 8))) & 1;
+        // 8x16 objects ignore bit 0 of the tile index and span 2 consecutive tiles
+        if (obj_h == 16) tile_idx &= 0xFE;
+        int row = ly - (obj[0] - 16);
+        if (yflip) row = obj_h - 1 - row;
 
-        u8 color_idx = (bit1 << 1) | bit0; // 0-3 (2bpp)
-        u8 palette_idx = bgp_tbl[color_idx];
-        Color color = PALETTE[palette_idx];
+        const u8 *tile_row = gb->memory + _VRAM8000 + tile_idx*16 + row*2;
+        u8 low_bitplane  = tile_row[0];
+        u8 high_bitplane = tile_row[1];
+        if (xflip) {
+            low_bitplane  = REVERSE_BITS[low_bitplane];
+            high_bitplane = REVERSE_BITS[high_bitplane];
+        }
 
-        //gb->display[px_row*256 + ((px_col + scx) % 256)] = color;
-        gb->display[px_row*256 + px_col] = color;
+        u8 flags = (plt_idx ? OBJ_LINE_PALETTE : 0) | (bg_win_over ? OBJ_LINE_BEHIND : 0);
+        for (int col = 0; col < 8; col++) {
+            if (x + col < 0 || x + col >= SCRN_X) continue;
+            u8 color_idx = gb_tile_row_color_idx(low_bitplane | (high_bitplane << 8), col);
+            if (color_idx == 0) continue; // Transparent
+            obj_line[x + col] = flags | color_idx;
+        }
     }
 }
 
-static void gb_render_sprites(GameBoy *gb)
+// On DMG, clearing LCDC.0 blanks both the BG and the window
+static bool gb_window_visible(const GameBoy *gb, int ly)
 {
     u8 lcdc = gb->memory[rLCDC];
-    if ((lcdc & LCDCF_OBJON) != LCDCF_OBJON) return;
-    u16 scx = gb->memory[rSCX];
-    u16 scy = gb->memory[rSCY];
-    for (int i = 0; i < OAM_COUNT; i++) {
-        u8 y = gb->memory[_OAMRAM + i*4 + 0] - 16;
-        u8 x = gb->memory[_OAMRAM + i*4 + 1] - 8;
-        u8 tile_idx = gb->memory[_OAMRAM + i*4 + 2];
-        u8 attribs  = gb->memory[_OAMRAM + i*4 + 3];
-
-        x = (x+scx) % 256;
-        y = (y+scy) % 256;
+    return (lcdc & LCDCF_BGON) == LCDCF_BGON &&
+        (lcdc & LCDCF_WINON) == LCDCF_WINON &&
+        ly >= gb->memory[rWY] && gb->memory[rWX] - 7 < SCRN_X;
+}
 
-        u8 bg_win_over = (attribs >> 7) & 1;
-        u8 yflip = (attribs >> 6) & 1;
-        u8 xflip = (attribs >> 5) & 1;
-        u8 plt_idx = (attribs >> 4) & 1;
+// Mode 3: composes BG, window and objects of line LY into the display in a single pass.
+// Expects the OAM scan of the same line (ppu_oam_scan) to be done.
+void gb_render_line(GameBoy *gb, int ly)
+{
+    assert(ly >= 0 && ly < SCRN_Y);
+    u8 lcdc = gb->memory[rLCDC];
+    if ((lcdc & LCDCF_ON) != LCDCF_ON) return;
 
-        // TODO: Support BG/Win over OBJ
-        //assert(bg_win_over == 0);
-        (void)bg_win_over;
+    PPU *ppu = &gb->ppu;
+    u8 scx = gb->memory[rSCX];
+    u8 scy = gb->memory[rSCY];
+    int wx = gb->memory[rWX] - 7;
+    u8 bgp = gb->memory[rBGP];
+    u8 obp[2] = {gb->memory[rOBP0], gb->memory[rOBP1]};
 
-        u8 *tile_start = gb->memory + _VRAM8000 + tile_idx*16;
-        u8 tile[16];
-        memcpy(tile, tile_start, 16);
-        if (xflip) {
-            for (int i = 0; i < 16; i++) {
-                u8 *b = tile + i;
-                *b = flip_horz(*b);
-            }
-        }
-        if (yflip) {
-            flip_vert(tile);
-        }
+    u8 obj_line[SCRN_X] = {0};
+    if ((lcdc & LCDCF_OBJON) == LCDCF_OBJON) {
+        gb_render_sprites(gb, ly, obj_line);
+    }
 
-        fill_tile(gb, x, yflip ? (y + 8) : y, tile, true, gb->memory[rOBP0+plt_idx]);
+    bool bg_on = (lcdc & LCDCF_BGON) == LCDCF_BGON;
+    bool win_on = gb_window_visible(gb, ly);
+    int win_start = win_on ? (wx < 0 ? 0 : wx) : SCRN_X;
 
-        if(lcdc & LCDCF_OBJ16) {
-            u8 *tile_start = gb->memory + _VRAM8000 + (tile_idx+1)*16;
-            u8 tile[16];
-            memcpy(tile, tile_start, 16);
+    u16 bg_tm_off  = (lcdc & LCDCF_BG9C00) == LCDCF_BG9C00 ? _SCRN1 : _SCRN0;
+    u16 win_tm_off = (lcdc & LCDCF_WIN9C00) == LCDCF_WIN9C00 ? _SCRN1 : _SCRN0;
 
-            if (xflip) {
-                for (int i = 0; i < 16; i++) {
-                    u8 *b = tile + i;
-                    *b = flip_horz(*b);
+    Color *out = gb->display + ly*SCRN_X;
+    u16 tile_row = 0;
+    for (int x = 0; x < SCRN_X; x++) {
+        u8 color_idx = 0;
+        if (x < win_start) {
+            if (bg_on) {
+                u8 bg_x = scx + x;
+                if (x == 0 || (bg_x % 8) == 0) {
+                    tile_row = gb_fetch_tile_row(gb, bg_tm_off, lcdc, bg_x, scy + ly);
                 }
+                color_idx = gb_tile_row_color_idx(tile_row, bg_x % 8);
             }
-            if (yflip) {
-                flip_vert(tile);
+        } else {
+            u8 win_x = x - wx;
+            if (x == win_start || (win_x % 8) == 0) {
+                tile_row = gb_fetch_tile_row(gb, win_tm_off, lcdc, win_x, ppu->window_line);
             }
+            color_idx = gb_tile_row_color_idx(tile_row, win_x % 8);
+        }
 
-            fill_tile(gb, x, yflip ? y : (y + 8), tile, true, gb->memory[rOBP0+plt_idx]);
+        Color color = PALETTE[(bgp >> (color_idx*2)) & 3];
+        u8 obj = obj_line[x];
+        if ((obj & 3) != 0 && !((obj & OBJ_LINE_BEHIND) && color_idx != 0)) {
+            u8 plt = obp[(obj & OBJ_LINE_PALETTE) ? 1 : 0];
+            color = PALETTE[(plt >> ((obj & 3)*2)) & 3];
         }
+        out[x] = color;
     }
+
+    // The window keeps its own line counter, only advanced on lines where it was drawn
+    if (win_on) ppu->window_line += 1;
 }
 
-static void gb_render_window(GameBoy *gb)
+// Debug view: the whole 256x256 BG tilemap selected by LCDC, through BGP
+void gb_render_bg_map(const GameBoy *gb, Color *pixels)
 {
     u8 lcdc = gb->memory[rLCDC];
-    if ((lcdc & LCDCF_WINON) != LCDCF_WINON) return;
-#if 0
-    //u8 wx = gb->memory[rWX] - 7;
-    //u8 wy = gb->memory[rWY];
-    //printf("WX: %3d, WY: %3d\n", wx, wy);
-    //assert(0 && "Window rendering is not implemented");
-
-    u16 bg_tm_off = (lcdc & LCDCF_BG9C00) == LCDCF_BG9C00 ? _SCRN1 : _SCRN0;
-
-    for (int row = wy; row < SCRN_VY_B; row++) {
-        for (int col = wx; col < SCRN_VX_B; col++) {
-            int tile_idx = gb->memory[bg_tm_off + row*32 + col];
-            if (bg_win_td_off == _VRAM9000) tile_idx = (int8_t)tile_idx;
-            fill_solid_tile(gb, col*8, row*8, 0xff);
-            u8 *tile = gb->memory + bg_win_td_off + tile_idx*16;
-            fill_tile(gb, col*8, row*8, tile, false, gb->memory[rBGP]);
+    u8 bgp = gb->memory[rBGP];
+    u16 tm_off = (lcdc & LCDCF_BG9C00) == LCDCF_BG9C00 ? _SCRN1 : _SCRN0;
+    for (int y = 0; y < 256; y++) {
+        for (int x = 0; x < 256; x++) {
+            u16 tile_row = gb_fetch_tile_row(gb, tm_off, lcdc, x, y);
+            u8 color_idx = gb_tile_row_color_idx(tile_row, x % 8);
+            pixels[y*256 + x] = PALETTE[(bgp >> (color_idx*2)) & 3];
         }
     }
-#endif
 }
 
 void gb_render(GameBoy *gb)
@@ -1317,18 +1263,12 @@ void gb_render(GameBoy *gb)
     u8 lcdc = gb->memory[rLCDC];
     if ((lcdc & LCDCF_ON) != LCDCF_ON) return;
 
-    // Render the Background
-    if ((lcdc & LCDCF_BGON) == LCDCF_BGON) {
-        for (int px_row = 0; px_row < 256; px_row++) {
-            gb_render_row(gb, px_row);
-        }
+    gb->ppu.window_line = 0;
+    memset(gb->ppu.line_state, 0, sizeof(gb->ppu.line_state));
+    for (int ly = 0; ly < SCRN_Y; ly++) {
+        ppu_oam_scan(gb, ly);
+        gb_render_line(gb, ly);
     }
-
-    // Render the Window
-    gb_render_window(gb);
-
-    // Render the Sprites (OBJ)
-    gb_render_sprites(gb);
 }
 
 void gb_load_boot_rom(GameBoy *gb)
@@ -1342,9 +1282,12 @@ void gb_load_boot_rom(GameBoy *gb)
     gb->PC = 0;
 }
 
-void gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
+GB_Status gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
 {
-    assert(size > 0x14F);
+    if (size <= 0x14F) {
+        fprintf(stderr, "ROM is too small to hold a header\n");
+        return gb->status = GB_STATUS_BAD_ROM;
+    }
     ROM_Header *header = (ROM_Header*)(raw + 0x100);
     bool log_rom_info = false;
     if (log_rom_info) {
@@ -1372,7 +1315,7 @@ void gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
 
     if (memcmp(header->logo, NINTENDO_LOGO, sizeof(NINTENDO_LOGO)) != 0) {
         fprintf(stderr, "Nintendo Logo does NOT match\n");
-        exit(1);
+        return gb->status = GB_STATUS_BAD_ROM;
     }
 
     u8 checksum = 0;
@@ -1381,18 +1324,21 @@ void gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
     }
     if (header->header_check != checksum) {
         fprintf(stderr, "    Checksum does NOT match: %02X vs. %02X\n", header->header_check, checksum);
-        exit(1);
+        return gb->status = GB_STATUS_BAD_ROM;
     }
 
     //assert(header->cart_type == 0);
 
-    gb->cart_type = header->cart_type;
+    u8 cart_type = header->cart_type;
+    if (cart_type == 0 ? size != 32*1024 : !(cart_type == 1 || cart_type == 3 || cart_type == 0x13)) {
+        fprintf(stderr, "Unsupported cartridge type $%02X (%zu bytes)\n", cart_type, size);
+        return gb->status = GB_STATUS_BAD_ROM;
+    }
+    gb->cart_type = cart_type;
 
-    // TODO: Handle MBC1
     gb->rom = malloc(size);
     assert(gb->rom);
     if (gb->cart_type == 0) {
-        assert(size == 32*1024);
         memcpy(gb->rom, raw, size);
         gb->rom_bank_count = 2;
 
@@ -1405,8 +1351,6 @@ void gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
         }
 
         memcpy(gb->memory, raw, 32*1024); // Copy only the first 2 banks
-    } else {
-        assert(0 && "MBC not implemented yet!");
     }
 
 #if 0
@@ -1427,77 +1371,442 @@ void gb_load_rom(GameBoy *gb, u8 *raw, size_t size)
     gb->memory[rSTAT] = 0x85;
 #endif
 
-    gb->timer_div = (1000.0 / 16384.0);
+    gb->div_counter = 0xABCC; // DMG value after the boot ROM
+    gb->memory[rDIV] = gb->div_counter >> 8;
+
+    // The boot ROM leaves the APU powered with full volume on both sides
+    gb_apu_write(gb, rNR52, 0x80);
+    gb_apu_write(gb, rNR50, 0x77);
+    gb_apu_write(gb, rNR51, 0xF3);
+
+    return gb->status = GB_STATUS_OK;
 }
 
-void gb_load_rom_file(GameBoy *gb, const char *path)
+GB_Status gb_load_rom_file(GameBoy *gb, const char *path)
 {
     //printf("Loading ROM \"%s\"...\n", path);
     size_t size;
     u8 *raw = read_entire_file(path, &size);
-    gb_load_rom(gb, raw, size);
+    if (raw == NULL) return gb->status = GB_STATUS_IO_ERROR;
+    GB_Status status = gb_load_rom(gb, raw, size);
     free(raw);
+    return status;
 }
 
-void gb_tick_ms(GameBoy *gb, f64 dt_ms)
+// Executes one instruction (or dispatches an interrupt, or idles while halted)
+// and advances the timer and the PPU by the T-cycles it took
+u32 gb_step(GameBoy *gb)
+{
+    Inst inst = gb_fetch(gb);
+    int cycles = gb_exec(gb, inst);
+    if (cycles < 0) {
+        // Halted: nothing can wake the CPU before the next timer or PPU event
+        u32 idle = gb_timer_cycles_to_irq(gb);
+        u32 ppu_idle = ppu_cycles_to_event(gb);
+        if (ppu_idle < idle) idle = ppu_idle;
+        if (gb->serial_cycles && gb->serial_cycles < idle) idle = gb->serial_cycles;
+        if (idle > DOTS_PER_SCANLINE) idle = DOTS_PER_SCANLINE;
+        cycles = idle > 4 ? (idle + 3) & ~3u : 4;
+    } else if (cycles == 0) {
+        cycles = 20; // Interrupt dispatch (5 M-cycles)
+    }
+
+    gb->elapsed_cycles += cycles;
+    gb_timer_tick(gb, cycles);
+    if (gb->serial_cycles) gb_serial_tick(gb, cycles);
+    ppu_tick(gb, cycles);
+    if (gb->elapsed_cycles >= gb->apu.status_at) gb_apu_sync(gb);
+    return cycles;
+}
+
+// Runs the emulation until it catches up with the given amount of host time.
+// The last instruction may overshoot, which is deducted from the next call.
+void gb_tick_us(GameBoy *gb, u64 dt_us)
 {
     if (gb->paused) return;
 
-    static f64 dt_cycle = 0.0;
-    dt_cycle += dt_ms;
-    while (dt_cycle > (1000.0 / CPU_FREQ)) {
-        gb->elapsed_cycles += 1;
-        dt_cycle -= (1000.0 / CPU_FREQ);
+    gb->elapsed_us += dt_us;
+    u64 target_cycles = gb->elapsed_us * (u64)CPU_FREQ / 1000000;
+    while (gb->elapsed_cycles < target_cycles) gb_step(gb);
+}
+
+void gb_tick_ms(GameBoy *gb, f64 dt_ms)
+{
+    gb_tick_us(gb, (u64)(dt_ms*1000.0 + 0.5));
+}
+
+// Runs until the PPU enters VBlank, so that display holds a complete frame.
+// With the LCD off it runs for one frame worth of cycles instead.
+u32 gb_run_frame(GameBoy *gb)
+{
+    if (gb->paused) return 0;
+
+    u64 frame = gb->ppu.frame;
+    u32 cycles = 0;
+    while (cycles < DOTS_PER_FRAME && gb->ppu.frame == frame) cycles += gb_step(gb);
+    return cycles;
+}
+
+void gb_set_buttons(GameBoy *gb, u8 buttons)
+{
+    gb->button_a      = (buttons & GB_BUTTON_A) != 0;
+    gb->button_b      = (buttons & GB_BUTTON_B) != 0;
+    gb->button_select = (buttons & GB_BUTTON_SELECT) != 0;
+    gb->button_start  = (buttons & GB_BUTTON_START) != 0;
+    gb->dpad_right    = (buttons & GB_BUTTON_RIGHT) != 0;
+    gb->dpad_left     = (buttons & GB_BUTTON_LEFT) != 0;
+    gb->dpad_up       = (buttons & GB_BUTTON_UP) != 0;
+    gb->dpad_down     = (buttons & GB_BUTTON_DOWN) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Batch                                            //
+///////////////////////////////////////////////////////////////////////////////
+static void gb_batch_mirror(GB_Batch *batch, u32 i)
+{
+    const GameBoy *gb = &batch->envs[i];
+    batch->pc[i] = gb->PC;
+    batch->sp[i] = gb->SP;
+    batch->af[i] = gb->AF;
+    batch->bc[i] = gb->BC;
+    batch->de[i] = gb->DE;
+    batch->hl[i] = gb->HL;
+    batch->status[i] = gb->status;
+}
+
+GB_Status gb_batch_init(GB_Batch *batch, u8 *raw, size_t size, u32 count)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->initial = calloc(1, sizeof(GameBoy));
+    assert(batch->initial);
+    GB_Status status = gb_load_rom(batch->initial, raw, size);
+    if (status != GB_STATUS_OK) {
+        free(batch->initial);
+        batch->initial = NULL;
+        return status;
+    }
+    gb_init(batch->initial);
+    batch->initial->initialized = true;
+    gb_set_render_policy(batch->initial, RP_ON_REQUEST, 0); // Frames only when requested
+    batch->rom = batch->initial->rom;
+
+    batch->count = count;
+    batch->envs = malloc(count * sizeof(GameBoy));
+    batch->pc = malloc(count * sizeof(u16));
+    batch->sp = malloc(count * sizeof(u16));
+    batch->af = malloc(count * sizeof(u16));
+    batch->bc = malloc(count * sizeof(u16));
+    batch->de = malloc(count * sizeof(u16));
+    batch->hl = malloc(count * sizeof(u16));
+    batch->status = malloc(count * sizeof(GB_Status));
+    batch->frame_start = malloc(count * sizeof(u64));
+    batch->frame_cycles = malloc(count * sizeof(u32));
+    assert(batch->envs && batch->pc && batch->sp && batch->af && batch->bc && batch->de && batch->hl);
+    assert(batch->status && batch->frame_start && batch->frame_cycles);
+    for (u32 i = 0; i < count; i++) {
+        memcpy(&batch->envs[i], batch->initial, sizeof(GameBoy));
+        gb_batch_mirror(batch, i);
+    }
+    return GB_STATUS_OK;
+}
+
+void gb_batch_free(GB_Batch *batch)
+{
+    free(batch->rom);
+    free(batch->initial);
+    free(batch->envs);
+    free(batch->pc);
+    free(batch->sp);
+    free(batch->af);
+    free(batch->bc);
+    free(batch->de);
+    free(batch->hl);
+    free(batch->status);
+    free(batch->frame_start);
+    free(batch->frame_cycles);
+    memset(batch, 0, sizeof(*batch));
+}
+
+void gb_batch_reset(GB_Batch *batch, u32 i)
+{
+    assert(i < batch->count);
+    gb_reset_from(&batch->envs[i], batch->initial);
+    gb_batch_mirror(batch, i);
+}
+
+// Runs the first n instances for one frame each, as gb_run_frame would, with
+// actions[i] (GB_BUTTON_*) held down. Instead of one whole frame after the
+// other, every instance advances one scanline per round: they all execute
+// the same stretch of ROM code back to back while it is hot in the caches.
+void gb_batch_step(GB_Batch *batch, const u8 *actions, u32 n)
+{
+    assert(n <= batch->count);
+    for (u32 i = 0; i < n; i++) {
+        gb_set_buttons(&batch->envs[i], actions ? actions[i] : 0);
+        batch->frame_start[i] = batch->envs[i].ppu.frame;
+        batch->frame_cycles[i] = batch->envs[i].paused ? DOTS_PER_FRAME : 0;
+    }
+
+    for (u32 target = DOTS_PER_SCANLINE;; target += DOTS_PER_SCANLINE) {
+        bool pending = false;
+        for (u32 i = 0; i < n; i++) {
+            GameBoy *gb = &batch->envs[i];
+            u64 frame = batch->frame_start[i];
+            u32 cycles = batch->frame_cycles[i];
+            while (cycles < target && cycles < DOTS_PER_FRAME && gb->ppu.frame == frame) cycles += gb_step(gb);
+            batch->frame_cycles[i] = cycles;
+            if (cycles < DOTS_PER_FRAME && gb->ppu.frame == frame) pending = true;
+        }
+        if (!pending) break;
     }
 
-    gb->elapsed_ms += dt_ms;
-    gb->timer_div  -= dt_ms;
+    for (u32 i = 0; i < n; i++) gb_batch_mirror(batch, i);
+}
 
-    while (gb->timer_div <= 0) {
-        gb->timer_div += (1000.0 / 16384.0);
-        gb->memory[rDIV] += 1;
+///////////////////////////////////////////////////////////////////////////////
+//                          Pool                                             //
+///////////////////////////////////////////////////////////////////////////////
+// Restores an instance that was copied from initial before (and has run
+// since) without copying all of it:
+// - display is output only. The PPU line cache is cleared (the one of initial
+//   describes initial's display), so the next rendered frame redraws every line.
+// - Of memory, ROM bank 0 is never written and the switchable bank only
+//   needs restoring after a bank switch.
+// - The blip buffer only holds samples while a sample rate is set.
+void gb_reset_from(GameBoy *gb, const GameBoy *initial)
+{
+    bool bank_switched = gb->rom_bank_num != initial->rom_bank_num;
+    memcpy(gb, initial, offsetof(GameBoy, display));
+    if (bank_switched) memcpy(gb->memory + 0x4000, initial->memory + 0x4000, 0x4000);
+    memcpy(gb->memory + 0x8000, initial->memory + 0x8000, 0x8000);
+    memcpy(&gb->cart_type, &initial->cart_type, offsetof(GameBoy, apu) - offsetof(GameBoy, cart_type));
+    memcpy(&gb->apu, &initial->apu, initial->apu.sample_rate ? sizeof(APU) : offsetof(APU, blip));
+    memcpy(gb->serial_buffer, initial->serial_buffer, sizeof(GameBoy) - offsetof(GameBoy, serial_buffer));
+    memset(gb->ppu.line_state, 0, sizeof(gb->ppu.line_state));
+}
+
+GB_Status gb_pool_init(GB_Pool *pool, u8 *raw, size_t size, u32 count, u32 flags)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+    pool->stride = (sizeof(GameBoy) + GB_POOL_CACHE_LINE - 1) & ~(size_t)(GB_POOL_CACHE_LINE - 1);
+    size_t rom_offset = (count + 1) * pool->stride;
+    size_t free_offset = (rom_offset + size + GB_POOL_CACHE_LINE - 1) & ~(size_t)(GB_POOL_CACHE_LINE - 1);
+    pool->mapped = free_offset + count * sizeof(u32);
+
+    u8 *base = platform_alloc_pages(pool->mapped, flags & GB_POOL_HUGE_PAGES, &pool->huge_pages);
+    if (base == NULL) {
+        fprintf(stderr, "Failed to map %zu bytes for %u instances\n", pool->mapped, count);
+        return GB_STATUS_IO_ERROR;
     }
+    pool->slots = base;
+    pool->initial = (GameBoy*)(base + count * pool->stride);
+    pool->rom = base + rom_offset;
+    pool->free_slots = (u32*)(base + free_offset);
 
-    if (gb->memory[rTAC] & 0x04) {
-        gb->timer_tima -= dt_ms;
-        int freq = gb_clock_freq(gb->memory[rTAC]);
-        while (gb->timer_tima <= 0) {
-            gb->timer_tima += (1000.0 / freq);
-            gb->memory[rTIMA] += 1;
-            if (gb->memory[rTIMA] == 0) {
-                gb->memory[rTIMA] = gb->memory[rTMA];
-                gb->memory[rIF] |= 0x04;
+    GB_Status status = gb_load_rom(pool->initial, raw, size);
+    if (status != GB_STATUS_OK) {
+        gb_pool_free(pool);
+        return status;
+    }
+    memcpy(pool->rom, pool->initial->rom, size);
+    free(pool->initial->rom);
+    pool->initial->rom = pool->rom;
+    gb_init(pool->initial);
+    pool->initial->initialized = true;
+    gb_set_render_policy(pool->initial, RP_ON_REQUEST, 0); // Frames only when requested
+
+    // Full copies once, so that gb_reset_from applies. This also touches
+    // every slot from the calling thread (first-touch NUMA placement).
+    for (u32 i = 0; i < count; i++) {
+        memcpy(base + i * pool->stride, pool->initial, sizeof(GameBoy));
+        pool->free_slots[i] = count - 1 - i;
+    }
+    pool->free_count = count;
+    return GB_STATUS_OK;
+}
+
+void gb_pool_free(GB_Pool *pool)
+{
+    if (pool->slots) platform_free_pages(pool->slots, pool->mapped, pool->huge_pages);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Returns a slot in the state right after loading, or NULL if all are in use
+GameBoy *gb_pool_acquire(GB_Pool *pool)
+{
+    if (pool->free_count == 0) return NULL;
+    u32 i = pool->free_slots[--pool->free_count];
+    GameBoy *gb = (GameBoy*)(pool->slots + i * pool->stride);
+    gb_reset_from(gb, pool->initial);
+    return gb;
+}
+
+void gb_pool_release(GB_Pool *pool, GameBoy *gb)
+{
+    size_t offset = (u8*)gb - pool->slots;
+    assert(offset % pool->stride == 0 && offset / pool->stride < pool->count);
+    assert(pool->free_count < pool->count);
+    pool->free_slots[pool->free_count++] = (u32)(offset / pool->stride);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Serial Link                                      //
+///////////////////////////////////////////////////////////////////////////////
+// A transfer is started by the side using the internal clock (SC = $81) and
+// shifts 8 bits at 8192 Hz. The bytes are exchanged as a whole when it
+// completes; the other side only takes part if it is waiting with the
+// external clock (SC = $80), otherwise the master reads $FF (line pulled up).
+#define SERIAL_TRANSFER_CYCLES 4096 // 8 bits at 8192 Hz
+
+void gb_link_connect(GB_Link *link, GameBoy *a, GameBoy *b, u32 quantum)
+{
+    memset(link, 0, sizeof(*link));
+    link->gb[0] = a;
+    link->gb[1] = b;
+    link->quantum = quantum ? quantum : DOTS_PER_SCANLINE;
+    a->link = link;
+    b->link = link;
+}
+
+void gb_link_disconnect(GB_Link *link)
+{
+    for (int i = 0; i < 2; i++) {
+        if (link->gb[i]) link->gb[i]->link = NULL;
+        link->gb[i] = NULL;
+    }
+}
+
+void gb_serial_tick(GameBoy *gb, u32 cycles)
+{
+    if (cycles < gb->serial_cycles) {
+        gb->serial_cycles -= cycles;
+        return;
+    }
+    gb->serial_cycles = 0;
+
+    u8 in = 0xFF;
+    GB_Link *link = gb->link;
+    GameBoy *peer = link ? link->gb[link->gb[0] == gb] : NULL;
+    if (peer && (peer->memory[rSC] & 0x81) == 0x80) {
+        in = peer->memory[rSB];
+        peer->memory[rSB] = gb->memory[rSB];
+        peer->memory[rSC] &= ~0x80;
+        peer->memory[rIF] |= IEF_SERIAL;
+    }
+    gb->memory[rSB] = in;
+    gb->memory[rSC] &= ~0x80;
+    gb->memory[rIF] |= IEF_SERIAL;
+}
+
+// Runs both sides for the given amount of T-cycles. A side is never more than
+// a quantum (plus one instruction) ahead of the other, and before a transfer
+// completes the peer is brought up to that same point, so the exchange sees
+// the peer as it is at that moment.
+void gb_link_run(GB_Link *link, u64 cycles)
+{
+    u64 end = (link->cycles[0] < link->cycles[1] ? link->cycles[0] : link->cycles[1]) + cycles;
+    for (;;) {
+        u64 now = link->cycles[0] < link->cycles[1] ? link->cycles[0] : link->cycles[1];
+        if (now >= end) break;
+        u64 target = now + link->quantum;
+        if (target > end) target = end;
+
+        // The side clocking a transfer runs last, after its peer reached the
+        // point where the transfer completes
+        int first = 0;
+        for (int i = 0; i < 2; i++) {
+            GameBoy *gb = link->gb[i];
+            if (gb->serial_cycles == 0) continue;
+            u64 done = link->cycles[i] + gb->serial_cycles;
+            if (done < target) target = done > now ? done : now + 1;
+            first = !i;
+        }
+
+        for (int j = 0; j < 2; j++) {
+            int i = j ? !first : first;
+            GameBoy *gb = link->gb[i];
+            while (link->cycles[i] < target) {
+                if (gb->paused || gb->status != GB_STATUS_OK) {
+                    link->cycles[i] = target;
+                    break;
+                }
+                link->cycles[i] += gb_step(gb);
             }
         }
     }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Timer                                            //
+///////////////////////////////////////////////////////////////////////////////
+// The timer unit is clocked in T-cycles. Instead of stepping every cycle, the
+// falling edges of the divider bit selected by TAC are counted arithmetically.
+static void gb_timer_inc_tima(GameBoy *gb)
+{
+    gb->memory[rTIMA] += 1;
+    if (gb->memory[rTIMA] == 0) {
+        // TIMA reads $00 for 4 cycles before being reloaded from TMA
+        gb->tima_reload = 4;
+    }
+}
 
-    static f64 dt = 0.0;
-    dt += dt_ms;
+static bool gb_timer_signal(u16 div_counter, u8 tac)
+{
+    return (tac & TACF_START) && (div_counter & TAC_DIV_BIT[tac & 3]);
+}
 
-    int n = 0;
-    while (dt > 0) {
-        Inst inst = gb_fetch(gb);
-        if (((1000.0 / CPU_FREQ) * inst.cycles) > dt) {
-            break;
+void gb_timer_tick(GameBoy *gb, u32 cycles)
+{
+    while (cycles > 0) {
+        if (gb->tima_reload > 0) {
+            u32 step = cycles < gb->tima_reload ? cycles : gb->tima_reload;
+            gb->div_counter += step;
+            gb->tima_reload -= step;
+            cycles -= step;
+            if (gb->tima_reload == 0) {
+                gb->memory[rTIMA] = gb->memory[rTMA];
+                gb->memory[rIF] |= IEF_TIMER;
+            }
+            continue;
         }
 
-        int cycles = gb_exec(gb, inst);
-        if (cycles <= 0) {
+        u8 tac = gb->memory[rTAC];
+        if ((tac & TACF_START) == 0) {
+            gb->div_counter += cycles;
             break;
         }
-        if (n > 1000) {
+
+        u32 period = TAC_DIV_BIT[tac & 3] << 1;
+        u32 to_edge = period - (gb->div_counter & (period - 1));
+        u32 to_overflow = to_edge + (0xFF - gb->memory[rTIMA])*period;
+        if (cycles < to_overflow) {
+            if (cycles >= to_edge) gb->memory[rTIMA] += 1 + (cycles - to_edge) / period;
+            gb->div_counter += cycles;
             break;
         }
-        break;
 
-        dt -= ((1000.0 / CPU_FREQ) * cycles);
-        n += 1;
+        gb->div_counter += to_overflow;
+        cycles -= to_overflow;
+        gb->memory[rTIMA] = 0xFF;
+        gb_timer_inc_tima(gb);
     }
+    gb->memory[rDIV] = gb->div_counter >> 8;
+}
+
+// T-cycles until the timer requests an interrupt (UINT32_MAX if it won't)
+u32 gb_timer_cycles_to_irq(const GameBoy *gb)
+{
+    if (gb->tima_reload > 0) return gb->tima_reload;
+
+    u8 tac = gb->memory[rTAC];
+    if ((tac & TACF_START) == 0) return UINT32_MAX;
+
+    u32 period = TAC_DIV_BIT[tac & 3] << 1;
+    u32 to_edge = period - (gb->div_counter & (period - 1));
+    return to_edge + (0xFF - gb->memory[rTIMA])*period + 4;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//                          Timer                                            //
-///////////////////////////////////////////////////////////////////////////////
 #include <sys/time.h>
 
 static uint64_t get_ticks(void)
@@ -1531,7 +1840,7 @@ void timer_update(Timer *timer)
 ///////////////////////////////////////////////////////////////////////////////
 //                          GameBoy                                          //
 ///////////////////////////////////////////////////////////////////////////////
-void gb_init_with_args(GameBoy *gb, int argc, char **argv)
+GB_Status gb_init_with_args(GameBoy *gb, int argc, char **argv)
 {
     // Command line options:
     // - Start in step-debug mode
@@ -1540,13 +1849,13 @@ void gb_init_with_args(GameBoy *gb, int argc, char **argv)
     // - path to ROM (last)
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <ROM path>\n", argv[0]);
-        exit(1);
+        return gb->status = GB_STATUS_IO_ERROR;
     }
 
     gb->running = true;
     gb->printf = printf;
 
-    gb_load_rom_file(gb, argv[argc - 1]);
+    return gb_load_rom_file(gb, argv[argc - 1]);
 }
 
 void gb_init(GameBoy *gb)
@@ -1587,42 +1896,22 @@ void gb_clock_step(GameBoy *gb)
 
 void gb_update(GameBoy *gb)
 {
-    static bool initialized = false;
-    if (!initialized) {
+    if (!gb->initialized) {
         gb_init(gb);
-        initialized = true;
+        gb->initialized = true;
     }
 
     timer_update(&gb->timer);
-    ppu_update(gb);
-    cpu_update(gb);
-
-    gb_render(gb);
-#if 0
-    gb_render_row(gb, gb->memory[rLY]); // LY 0-153
-    if (gb->memory[rLY] == 144) {
-        for (int row = 154; row < 256; row++) {
-            gb_render_row(gb, row);
-        }
 
-        gb_render_sprites(gb);
-    } else if ((gb->memory[rLCDC] & LCDCF_ON) == 0) {
-        for (int row = 0; row < 256; row++) {
-            gb_render_row(gb, row);
-        }
-    }
-#endif
+    // Don't try to catch up after the host stalled (debugger, window drag, ...)
+    u64 dt_us = gb->timer.dt_ticks;
+    if (dt_us > 100*1000) dt_us = 100*1000;
+    gb_tick_us(gb, dt_us);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //                          CPU                                              //
 ///////////////////////////////////////////////////////////////////////////////
-void cpu_update(GameBoy *gb)
-{
-    f64 dt_ms = TICKS_TO_MS(gb->timer.dt_ticks);
-    gb_tick_ms(gb, dt_ms);
-}
-
 u8 gb_get_flag(const GameBoy *gb, Flag flag)
 {
     switch (flag) {
@@ -1768,58 +2057,41 @@ void gb_serial_write(GameBoy *gb, u16 addr, u8 value)
     if (0) {}
     else if (addr == rSB) gb->memory[addr] = value;
     else if (addr == rSC) {
-        if (value == 0x81) {
+        // Unused bits read as 1
+        gb->memory[addr] = value | 0x7E;
+        if ((value & 0x81) == 0x81) {
             gb->serial_buffer[gb->serial_idx++] = gb->memory[rSB];
+            gb->serial_cycles = SERIAL_TRANSFER_CYCLES;
+        } else if (!(value & 0x80)) {
+            gb->serial_cycles = 0;
         }
-        gb->memory[addr] = 0xff;
     }
 }
 
 void gb_timer_write(GameBoy *gb, u16 addr, u8 value)
 {
     assert(addr == rDIV || addr == rTIMA || addr == rTMA || addr == rTAC);
+    // Resetting the divider or changing TAC can produce a falling edge on the
+    // signal that clocks TIMA, which increments it.
+    u8 tac = gb->memory[rTAC];
     if (0) {}
-    else if (addr == rDIV)  gb->memory[addr] = 0;
-    else if (addr == rTIMA) gb->memory[addr] = value;
+    else if (addr == rDIV) {
+        bool edge = gb_timer_signal(gb->div_counter, tac);
+        gb->div_counter = 0;
+        gb->memory[addr] = 0;
+        if (edge) gb_timer_inc_tima(gb);
+    }
+    else if (addr == rTIMA) {
+        // Writing TIMA during the reload delay cancels the reload
+        gb->tima_reload = 0;
+        gb->memory[addr] = value;
+    }
     else if (addr == rTMA)  gb->memory[addr] = value;
     else if (addr == rTAC) {
-        if (value & 0x04) {
-            int freq = gb_clock_freq(value);
-            gb->timer_tima = (1000.0 / freq);
-        }
+        bool edge = gb_timer_signal(gb->div_counter, tac) &&
+            !gb_timer_signal(gb->div_counter, value);
         gb->memory[addr] = value;
-    }
-}
-
-void gb_apu_write(GameBoy *gb, u16 addr, u8 value)
-{
-    bool is_ch1 = addr >= rNR10 && addr <= rNR14;
-    bool is_ch2 = addr >= rNR21 && addr <= rNR24;
-    bool is_ch3 = addr >= rNR30 && addr <= rNR34;
-    bool is_ch4 = addr >= rNR41 && addr <= rNR44;
-    bool is_wave = addr >= 0xff30 && addr <= 0xff3f;
-    assert(is_ch1 || is_ch2 || is_ch3 || is_ch4 || is_wave ||
-        addr == rNR50 || addr == rNR51 || addr == rNR52);
-
-    gb->memory[addr] = value;
-
-    if (addr == rNR52 && value == 0 && gb->serial_idx > 0) {
-        for (int i = 0; i < gb->serial_idx; i++) {
-            char c = gb->serial_buffer[i];
-            if (c < ' ' || c > '~') c = '.';
-            fprintf(stderr, "%c", c);
-        }
-        fprintf(stderr, "\n");
-
-        size_t len = strlen("Passed\n");
-        const char *passed_part = gb->serial_buffer + gb->serial_idx - len;
-        if (gb->serial_idx > len && strncmp(passed_part, "Passed\n", len) == 0) {
-            printf("Passed\n");
-            exit(0);
-        } else {
-            printf("Failed at $%04x\n", gb->PC);
-            //exit(1);
-        }
+        if (edge) gb_timer_inc_tima(gb);
     }
 }
 
@@ -1829,16 +2101,19 @@ void gb_ppu_write(GameBoy *gb, u16 addr, u8 value)
         addr == rLY || addr == rLYC || addr == rDMA ||
         addr == rBGP || addr == rOBP0 || addr == rOBP1 || addr == rWY || addr == rWX);
 
-    if (addr == rLCDC || addr == rSTAT) {
+    if (addr == rLCDC) {
         gb->memory[addr] = value;
+    } else if (addr == rSTAT || addr == rLYC) {
+        ppu_stat_write(gb, addr, value);
     } else if (addr == rSCY || addr == rSCX) {
         gb->memory[addr] = value;
     } else if (addr == rLY) {
-        gb->memory[addr] = value;
+        // Read-only
     } else if (addr == rDMA) {
         assert(value <= 0xdf);
         u16 src = value << 8;
         memcpy(gb->memory + 0xfe00, gb->memory + src, 0x9f);
+        gb->ppu.mem_gen += 1;
         gb->memory[addr] = value;
     } else if (addr == rBGP || addr == rOBP0 || addr == rOBP1) {
         gb->memory[addr] = value;
@@ -2003,6 +2278,7 @@ void gb_mem_write(GameBoy *gb, u16 addr, u8 value)
     // 8 KiB Video RAM (VRAM)
     else if (addr >= 0x8000 && addr <= 0x9fff) {
         gb->memory[addr] = value;
+        gb->ppu.mem_gen += 1;
     }
     // 8 KiB External RAM (Cartridge)
     else if (addr >= 0xa000 && addr <= 0xbfff) {
@@ -2023,6 +2299,7 @@ void gb_mem_write(GameBoy *gb, u16 addr, u8 value)
     // Object attribute memory (OAM)
     else if (addr >= 0xfe00 && addr <= 0xfe9f) {
         gb->memory[addr] = value;
+        gb->ppu.mem_gen += 1;
     }
     // Not Usable
     else if (addr >= 0xfea0 && addr <= 0xfeff) {
@@ -2053,95 +2330,817 @@ void gb_mem_write(GameBoy *gb, u16 addr, u8 value)
 // Frame  (154 lines)   => 17556 clocks
 //
 // 1048576 / 17556 = 59.7 Hz refresh rate
-static const f64 slowdown_factor = 1.0;
-static const f64 frame_time = slowdown_factor * (1.0 / VSYNC);
-static const f64 scanline_time = frame_time / 154;
-static const f64 dot_time = scanline_time / 456;
+//
+// The PPU is clocked in dots (1 dot = 1 T-cycle) and advances straight to the
+// next mode boundary. Mode 3 has a fixed length (no sprite/scroll penalties).
+#define MODE2_DOTS 80
+#define MODE3_DOTS 172
+
+static bool ppu_frame_wanted(const PPU *ppu)
+{
+    switch (ppu->render_policy) {
+        case RP_ALWAYS:     return true;
+        case RP_EVERY_NTH:  return ppu->render_requested || (ppu->frame % ppu->render_interval) == 0;
+        case RP_ON_REQUEST: return ppu->render_requested;
+        default: assert(0 && "Invalid render policy");
+    }
+    return true;
+}
+
+void gb_set_render_policy(GameBoy *gb, Render_Policy policy, u32 interval)
+{
+    assert(policy != RP_EVERY_NTH || interval > 0);
+    PPU *ppu = &gb->ppu;
+    ppu->render_policy = policy;
+    ppu->render_interval = interval;
+    ppu->frame_rendering = ppu_frame_wanted(ppu);
+}
+
+// The next frame to start is drawn from the VRAM/OAM/register state at each line
+void gb_request_frame(GameBoy *gb)
+{
+    gb->ppu.render_requested = true;
+}
 
 void ppu_init(PPU *ppu)
 {
-    ppu->frame_timer = frame_time;
-    ppu->scanline_timer = scanline_time;
-    ppu->dot_timer = dot_time;
+    ppu->frame_rendering = ppu_frame_wanted(ppu);
 }
 
-void ppu_update(GameBoy *gb)
+// Mode 2: select the (up to 10) objects that overlap line LY
+// Objects with a smaller X have priority, ties are resolved by OAM index
+void ppu_oam_scan(GameBoy *gb, int ly)
 {
-    if ((gb->memory[rLCDC] & LCDCF_ON) == 0) return;
+    PPU *ppu = &gb->ppu;
+    int obj_h = (gb->memory[rLCDC] & LCDCF_OBJ16) ? 16 : 8;
+    const u8 *oam = gb->memory + _OAMRAM;
+
+    ppu->line_obj_count = 0;
+    for (int i = 0; i < OAM_COUNT && ppu->line_obj_count < OBJS_PER_LINE; i++) {
+        int y = oam[i*4 + 0] - 16;
+        if (ly < y || ly >= y + obj_h) continue;
+
+        // Insertion sort by X (at most 10 entries)
+        u8 x = oam[i*4 + 1];
+        int n = ppu->line_obj_count++;
+        while (n > 0 && oam[ppu->line_objs[n - 1]*4 + 1] > x) {
+            ppu->line_objs[n] = ppu->line_objs[n - 1];
+            n--;
+        }
+        ppu->line_objs[n] = i;
+    }
+}
 
-    const Timer *timer = &gb->timer;
-    f64 elapsed = timer->elapsed_ticks*0.000001;
-    (void)elapsed;
-    f64 dt = timer->dt_ticks*0.000001;
+static bool ppu_line_state_eq(const PPU_Line_State *a, const PPU_Line_State *b)
+{
+    return a->valid == b->valid && a->mem_gen == b->mem_gen &&
+        a->lcdc == b->lcdc && a->scy == b->scy && a->scx == b->scx &&
+        a->wy == b->wy && a->wx == b->wx &&
+        a->bgp == b->bgp && a->obp0 == b->obp0 && a->obp1 == b->obp1 &&
+        a->window_line == b->window_line;
+}
 
+// Mode 3: draws line LY unless all of its inputs are the same as when it was last drawn
+static void ppu_draw_line(GameBoy *gb, int ly)
+{
     PPU *ppu = &gb->ppu;
-    ppu->frame_timer -= dt;
-    ppu->scanline_timer -= dt;
-    ppu->dot_timer -= dt;
-
-    if (!ppu->frame_started) {
-        ppu->frame_started = true;
-        //printf("%10lf: Frame %ld begin\n", elapsed, ppu->frame);
-    }
-
-    if (!ppu->scanline_started) {
-        ppu->scanline_started = true;
-        ppu->scanline_mode_count = 0;
-        ppu->mode = PM_HBLANK;
-        //printf("%10lf:   Scanline %d begin\n", elapsed, ppu->scanline);
-    }
-
-    while (ppu->dot_timer <= 0.0) {
-        ppu->dot_timer += dot_time;
-        ppu->dot = (ppu->dot + 1) % 456;
-        PPU_Mode new_mode = ppu->mode;
-        if (ppu->scanline >= 144)     new_mode = PM_VBLANK;
-        else if (ppu->dot < 80)       new_mode = PM_OAM;
-        else if (ppu->dot < (80+172)) new_mode = PM_DRAWING;
-        else new_mode = PM_HBLANK;
-
-        if (new_mode != ppu->mode) {
-            ppu->mode = new_mode;
-            ppu->scanline_mode_count += 1;
-            if (ppu->scanline_mode_count <= 3) {
-                //static const char *modes[] = {"HBlank", "VBlank", "OAM   ", "Draw  "};
-                //printf("%10lf:     Mode %s (%d) begin |dots: %d\n",
-                //    elapsed, modes[ppu->mode], ppu->mode, ppu->dot);
+    const u8 *io = gb->memory;
+    PPU_Line_State state = {
+        .valid = true,
+        .mem_gen = ppu->mem_gen,
+        .lcdc = io[rLCDC], .scy = io[rSCY], .scx = io[rSCX],
+        .wy = io[rWY], .wx = io[rWX],
+        .bgp = io[rBGP], .obp0 = io[rOBP0], .obp1 = io[rOBP1],
+        .window_line = ppu->window_line,
+    };
+
+    PPU_Line_State *prev = &ppu->line_state[ly];
+    if (!ppu_line_state_eq(prev, &state)) {
+        ppu_oam_scan(gb, ly);
+        gb_render_line(gb, ly);
+        *prev = state;
+        ppu->lines_changed = true;
+    } else if (gb_window_visible(gb, ly)) {
+        ppu->window_line += 1;
+    }
+}
+
+static void ppu_set_mode(GameBoy *gb, PPU_Mode mode)
+{
+    gb->ppu.mode = mode;
+    gb->memory[rSTAT] = (gb->memory[rSTAT] & ~STATF_LCD) | mode;
+}
+
+// The STAT interrupt is requested on the rising edge of the OR of all the
+// conditions selected in STAT (LYC=LY, mode 0, mode 1, mode 2)
+static void ppu_update_stat_irq(GameBoy *gb)
+{
+    u8 stat = gb->memory[rSTAT];
+    PPU_Mode mode = gb->ppu.mode;
+    bool line = gb->ppu.enabled && (
+        ((stat & STATF_LYC) && (stat & STATF_LYCF)) ||
+        ((stat & STATF_MODE00) && mode == PM_HBLANK) ||
+        ((stat & STATF_MODE01) && mode == PM_VBLANK) ||
+        ((stat & STATF_MODE10) && mode == PM_OAM));
+    if (line && !gb->ppu.stat_line) gb->memory[rIF] |= IEF_STAT;
+    gb->ppu.stat_line = line;
+}
+
+static void ppu_compare_lyc(GameBoy *gb)
+{
+    if (gb->memory[rLY] == gb->memory[rLYC]) gb->memory[rSTAT] |= STATF_LYCF;
+    else gb->memory[rSTAT] &= ~STATF_LYCF;
+}
+
+// Dot 0 of line LY: mode 2 (OAM scan) on visible lines, mode 1 from line 144
+static void ppu_start_line(GameBoy *gb, u32 ly)
+{
+    PPU *ppu = &gb->ppu;
+    ppu->scanline = ly;
+    ppu->dot = 0;
+    gb->memory[rLY] = ly;
+    ppu_compare_lyc(gb);
+
+    if (ly == 0) {
+        ppu->window_line = 0;
+        ppu->lines_changed = false;
+        ppu->frame_rendering = ppu_frame_wanted(ppu);
+    }
+
+    if (ly < SCRN_Y) {
+        ppu_set_mode(gb, PM_OAM);
+    } else if (ly == SCRN_Y) {
+        ppu_set_mode(gb, PM_VBLANK);
+        gb->memory[rIF] |= IEF_VBLANK;
+        ppu->frame += 1;
+        if (ppu->frame_rendering) {
+            ppu->render_requested = false;
+            if (ppu->lines_changed) ppu->frame_changed = true;
+        }
+    }
+    ppu_update_stat_irq(gb);
+}
+
+// Dot of the current line at which the current mode ends
+static u32 ppu_mode_end(const PPU *ppu)
+{
+    switch (ppu->mode) {
+        case PM_OAM:     return MODE2_DOTS;
+        case PM_DRAWING: return MODE2_DOTS + MODE3_DOTS;
+        default:         return DOTS_PER_SCANLINE;
+    }
+}
+
+void ppu_tick(GameBoy *gb, u32 cycles)
+{
+    PPU *ppu = &gb->ppu;
+
+    // With the LCD off, LY stays at 0 in mode 0. Turning it on starts a new frame.
+    if ((gb->memory[rLCDC] & LCDCF_ON) == 0) {
+        if (ppu->enabled) {
+            ppu->enabled = false;
+            ppu->scanline = 0;
+            ppu->dot = 0;
+            gb->memory[rLY] = 0;
+            ppu_set_mode(gb, PM_HBLANK);
+            ppu_update_stat_irq(gb);
+        }
+        return;
+    }
+    if (!ppu->enabled) {
+        ppu->enabled = true;
+        ppu_start_line(gb, 0);
+    }
+
+    while (cycles > 0) {
+        u32 end = ppu_mode_end(ppu);
+        u32 step = end - ppu->dot;
+        if (step > cycles) step = cycles;
+        ppu->dot += step;
+        cycles -= step;
+        if (ppu->dot < end) break;
+
+        if (ppu->mode == PM_OAM) {
+            ppu_set_mode(gb, PM_DRAWING);
+            if (ppu->frame_rendering) ppu_draw_line(gb, ppu->scanline);
+            ppu_update_stat_irq(gb);
+        } else if (ppu->mode == PM_DRAWING) {
+            ppu_set_mode(gb, PM_HBLANK);
+            ppu_update_stat_irq(gb);
+        } else {
+            u32 ly = ppu->scanline + 1;
+            if (ly == SCANLINES_PER_FRAME) ly = 0;
+            ppu_start_line(gb, ly);
+        }
+    }
+}
+
+// T-cycles until the PPU changes mode or line (UINT32_MAX with the LCD off)
+u32 ppu_cycles_to_event(const GameBoy *gb)
+{
+    if ((gb->memory[rLCDC] & LCDCF_ON) == 0) return UINT32_MAX;
+    if (!gb->ppu.enabled) return 0;
+    return ppu_mode_end(&gb->ppu) - gb->ppu.dot;
+}
+
+// STAT and LYC writes can raise the STAT interrupt line
+void ppu_stat_write(GameBoy *gb, u16 addr, u8 value)
+{
+    if (addr == rSTAT) {
+        // Only the interrupt selects (bits 3-6) are writable
+        gb->memory[rSTAT] = 0x80 | (value & 0x78) | (gb->memory[rSTAT] & 0x07);
+    } else {
+        gb->memory[rLYC] = value;
+        if (gb->ppu.enabled) ppu_compare_lyc(gb);
+    }
+    ppu_update_stat_irq(gb);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          APU                                              //
+///////////////////////////////////////////////////////////////////////////////
+// Channels are stepped from event to event (waveform steps and the 512 Hz frame
+// sequencer). Whenever the mixed output changes, the difference is added to a
+// band-limited step synthesizer, which produces samples at the host rate.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define APU_PI   3.14159265358979323846
+#define APU_LEAK 0.999f // Integrator leak: ~8 Hz high-pass that removes the DC offset
+
+static const u8 APU_DUTY[4] = {0x01, 0x81, 0x87, 0x7E}; // 12.5%, 25%, 50%, 75%
+static const u8 APU_NOISE_DIVISOR[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+static const u16 APU_NRX1[4] = {rNR11, rNR21, rNR31, rNR41};
+static const u16 APU_NRX2[4] = {rNR12, rNR22, rNR32, rNR42};
+static const u16 APU_NRX3[4] = {rNR13, rNR23, rNR33, rNR43};
+static const u16 APU_NRX4[4] = {rNR14, rNR24, rNR34, rNR44};
+
+// Windowed sinc (Blackman) for every sub-sample phase, cut slightly below
+// Nyquist and normalized so that a step of delta integrates to exactly delta
+static void blip_init_kernel(APU *apu)
+{
+    const f64 cutoff = 0.9;
+    for (int p = 0; p < BLIP_PHASES; p++) {
+        f64 taps[BLIP_WIDTH];
+        f64 sum = 0.0;
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            f64 x = (i - BLIP_WIDTH/2) - (f64)p / BLIP_PHASES;
+            f64 sinc = x == 0.0 ? 1.0 : sin(APU_PI*cutoff*x) / (APU_PI*cutoff*x);
+            f64 w = (x + BLIP_WIDTH/2 + 1) / (BLIP_WIDTH + 1);
+            taps[i] = sinc * (0.42 - 0.5*cos(2*APU_PI*w) + 0.08*cos(4*APU_PI*w));
+            sum += taps[i];
+        }
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            apu->kernel[p][2*i + 0] = (f32)(taps[i] / sum);
+            apu->kernel[p][2*i + 1] = (f32)(taps[i] / sum);
+        }
+    }
+}
+
+// Adds the impulse of a change of the output (delta_l, delta_r) at the given clock
+static void blip_add_delta(APU *apu, u32 time, f32 delta_l, f32 delta_r)
+{
+    Blip *b = &apu->blip;
+    u64 fixed = b->offset + (u64)time * apu->factor;
+    u64 index = fixed >> 32;
+    if (index >= BLIP_SIZE) return; // Only if nobody reads, see gb_apu_tick
+    const f32 *k = apu->kernel[(fixed >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+    f32 *out = b->buf + 2*index;
+
+#if defined(__SSE2__)
+    __m128 d = _mm_setr_ps(delta_l, delta_r, delta_l, delta_r);
+    for (int i = 0; i < 2*BLIP_WIDTH; i += 4) {
+        __m128 acc = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(k + i), d));
+        _mm_storeu_ps(out + i, acc);
+    }
+#else
+    for (int i = 0; i < 2*BLIP_WIDTH; i += 2) {
+        out[i + 0] += k[i + 0] * delta_l;
+        out[i + 1] += k[i + 1] * delta_r;
+    }
+#endif
+}
+
+// Integrates count stereo frames into out (NULL discards them)
+static void blip_read(Blip *b, f32 *out, size_t count)
+{
+    f32 sum_l = b->integrator[0], sum_r = b->integrator[1];
+    for (size_t i = 0; i < count; i++) {
+        sum_l = sum_l*APU_LEAK + b->buf[2*i + 0];
+        sum_r = sum_r*APU_LEAK + b->buf[2*i + 1];
+        if (out) {
+            out[2*i + 0] = sum_l;
+            out[2*i + 1] = sum_r;
+        }
+    }
+    b->integrator[0] = sum_l;
+    b->integrator[1] = sum_r;
+
+    size_t remaining = (b->offset >> 32) - count;
+    memmove(b->buf, b->buf + 2*count, 2*(remaining + BLIP_WIDTH) * sizeof(b->buf[0]));
+    memset(b->buf + 2*(remaining + BLIP_WIDTH), 0, 2*count * sizeof(b->buf[0]));
+    b->offset -= (u64)count << 32;
+}
+
+static u16 apu_freq(const GameBoy *gb, int c)
+{
+    return gb->memory[APU_NRX3[c]] | ((gb->memory[APU_NRX4[c]] & 7) << 8);
+}
+
+static void apu_update_period(GameBoy *gb, int c)
+{
+    APU_Channel *ch = &gb->apu.ch[c];
+    if (c == 3) {
+        // Shifts 14 and 15 don't clock the LFSR at all (period 0)
+        u8 nr43 = gb->memory[rNR43];
+        u8 shift = nr43 >> 4;
+        ch->period = shift >= 14 ? 0 : APU_NOISE_DIVISOR[nr43 & 7] << shift;
+    } else {
+        ch->period = (2048 - apu_freq(gb, c)) * (c == 2 ? 2 : 4);
+    }
+}
+
+static void apu_update_output(GameBoy *gb, int c)
+{
+    APU_Channel *ch = &gb->apu.ch[c];
+    u8 out = 0;
+    if (!ch->enabled) {
+        out = 0;
+    } else if (c == 2) {
+        u8 sample = gb->memory[_AUD3WAVERAM + ch->pos/2];
+        sample = (ch->pos & 1) ? sample & 0x0F : sample >> 4;
+        u8 level = (gb->memory[rNR32] >> 5) & 3; // Mute, 100%, 50%, 25%
+        out = level ? sample >> (level - 1) : 0;
+    } else if (c == 3) {
+        out = (ch->lfsr & 1) ? 0 : ch->volume;
+    } else {
+        u8 duty = gb->memory[APU_NRX1[c]] >> 6;
+        out = ((APU_DUTY[duty] >> ch->pos) & 1) ? ch->volume : 0;
+    }
+    ch->output = out;
+}
+
+// Whether stepping the waveform can change the output of the channel
+static bool apu_channel_audible(const GameBoy *gb, int c)
+{
+    const APU_Channel *ch = &gb->apu.ch[c];
+    if (!ch->enabled || ch->period == 0) return false;
+    if (c == 2) return (gb->memory[rNR32] & 0x60) != 0;
+    return ch->volume > 0;
+}
+
+// Advances the waveform of a channel by the given T-cycles. Audible channels
+// step at most once (gb_apu_tick stops at their next step), silent ones skip
+// ahead in bulk.
+static void apu_channel_advance(GameBoy *gb, int c, u32 cycles)
+{
+    APU_Channel *ch = &gb->apu.ch[c];
+    if (!ch->enabled || ch->period == 0) return;
+    if (cycles < ch->timer) {
+        ch->timer -= cycles;
+        return;
+    }
+    cycles -= ch->timer;
+    u32 steps = 1 + cycles / ch->period;
+    ch->timer = ch->period - cycles % ch->period;
+
+    if (c == 3) {
+        bool narrow = gb->memory[rNR43] & 0x08; // 7-bit LFSR
+        for (u32 i = 0; i < steps; i++) {
+            u16 bit = (ch->lfsr ^ (ch->lfsr >> 1)) & 1;
+            ch->lfsr = (ch->lfsr >> 1) | (bit << 14);
+            if (narrow) ch->lfsr = (ch->lfsr & ~(1 << 6)) | (bit << 6);
+        }
+    } else {
+        ch->pos = (ch->pos + steps) & (c == 2 ? 31 : 7);
+    }
+}
+
+static u16 apu_sweep_next(const GameBoy *gb)
+{
+    u8 nr10 = gb->memory[rNR10];
+    u16 delta = gb->apu.sweep_freq >> (nr10 & 7);
+    return (nr10 & 0x08) ? gb->apu.sweep_freq - delta : gb->apu.sweep_freq + delta;
+}
+
+static void apu_sweep_clock(GameBoy *gb)
+{
+    APU *apu = &gb->apu;
+    u8 nr10 = gb->memory[rNR10];
+    u8 pace = (nr10 >> 4) & 7;
+    if (apu->sweep_timer > 0) apu->sweep_timer -= 1;
+    if (apu->sweep_timer > 0) return;
+    apu->sweep_timer = pace ? pace : 8;
+    if (!apu->sweep_enabled || pace == 0) return;
+
+    u16 freq = apu_sweep_next(gb);
+    if (freq > 2047) {
+        apu->ch[0].enabled = false;
+    } else if (nr10 & 7) {
+        apu->sweep_freq = freq;
+        gb->memory[rNR13] = freq & 0xFF;
+        gb->memory[rNR14] = (gb->memory[rNR14] & ~7) | (freq >> 8);
+        apu_update_period(gb, 0);
+        if (apu_sweep_next(gb) > 2047) apu->ch[0].enabled = false;
+    }
+}
+
+// 512 Hz: length timers on even steps, sweep on steps 2 and 6, envelopes on step 7
+static void apu_frame_sequencer(GameBoy *gb)
+{
+    APU *apu = &gb->apu;
+    u8 step = apu->seq_step;
+    apu->seq_step = (step + 1) & 7;
+
+    for (int c = 0; c < 4; c++) {
+        APU_Channel *ch = &apu->ch[c];
+        if ((step & 1) == 0 && ch->length_enabled && ch->length > 0) {
+            ch->length -= 1;
+            if (ch->length == 0) ch->enabled = false;
+        }
+        if (step == 7 && c != 2 && ch->env_period > 0 && --ch->env_timer == 0) {
+            ch->env_timer = ch->env_period;
+            if (ch->env_up && ch->volume < 15) ch->volume += 1;
+            else if (!ch->env_up && ch->volume > 0) ch->volume -= 1;
+        }
+    }
+    if (step == 2 || step == 6) apu_sweep_clock(gb);
+}
+
+static void apu_trigger(GameBoy *gb, int c)
+{
+    APU *apu = &gb->apu;
+    APU_Channel *ch = &apu->ch[c];
+    ch->enabled = ch->dac;
+    if (ch->length == 0) ch->length = c == 2 ? 256 : 64;
+    apu_update_period(gb, c);
+    ch->timer = ch->period;
+    ch->pos = 0;
+
+    if (c != 2) {
+        u8 nrx2 = gb->memory[APU_NRX2[c]];
+        ch->volume = nrx2 >> 4;
+        ch->env_up = nrx2 & 0x08;
+        ch->env_period = nrx2 & 7;
+        ch->env_timer = ch->env_period;
+    }
+    if (c == 3) ch->lfsr = 0x7FFF;
+    if (c == 0) {
+        u8 nr10 = gb->memory[rNR10];
+        u8 pace = (nr10 >> 4) & 7;
+        apu->sweep_freq = apu_freq(gb, 0);
+        apu->sweep_timer = pace ? pace : 8;
+        apu->sweep_enabled = pace != 0 || (nr10 & 7) != 0;
+        if ((nr10 & 7) && apu_sweep_next(gb) > 2047) ch->enabled = false;
+    }
+}
+
+// Adds the change of the mixed output (NR50 volume, NR51 panning) to the blip buffers
+static void apu_mix(GameBoy *gb)
+{
+    APU *apu = &gb->apu;
+    u8 nr50 = gb->memory[rNR50];
+    u8 nr51 = gb->memory[rNR51];
+    if (apu->sample_rate == 0) return;
+
+    f32 left = 0.0f, right = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        if (!apu->ch[c].dac) continue;
+        f32 amp = apu->ch[c].output / 15.0f;
+        if (nr51 & (0x10 << c)) left += amp;
+        if (nr51 & (0x01 << c)) right += amp;
+    }
+    // Master volume (1-8)/8 and 4 channels: full scale is 1.0
+    left  *= (((nr50 >> 4) & 7) + 1) / 32.0f;
+    right *= ((nr50 & 7) + 1) / 32.0f;
+
+    if (left != apu->out_l || right != apu->out_r) {
+        blip_add_delta(apu, apu->clock, left - apu->out_l, right - apu->out_r);
+        apu->out_l = left;
+        apu->out_r = right;
+    }
+}
+
+// NR52 reports the power and which channels are on, bits 4-6 read as 1
+static void apu_update_status(GameBoy *gb)
+{
+    APU *apu = &gb->apu;
+    u8 status = apu->enabled ? 0xF0 : 0x70;
+    for (int c = 0; c < 4; c++) {
+        if (apu->ch[c].enabled) status |= 1 << c;
+        apu_update_output(gb, c);
+    }
+    gb->memory[rNR52] = status;
+    apu_mix(gb);
+}
+
+// Makes everything up to the current clock available for reading
+static void apu_end_frame(APU *apu)
+{
+    apu->blip.offset += (u64)apu->clock * apu->factor;
+    apu->clock = 0;
+}
+
+// Integrates up to max_frames samples of both sides into out (NULL discards them)
+static size_t apu_read_samples(APU *apu, f32 *out, size_t max_frames)
+{
+    apu_end_frame(apu);
+    size_t count = apu->blip.offset >> 32;
+    if (count > max_frames) count = max_frames;
+    blip_read(&apu->blip, out, count);
+    return count;
+}
+
+// Runs the APU for the given T-cycles. Without audio output, or while a channel
+// is silent, the waveforms advance in bulk and only the frame sequencer steps
+// are visited.
+void gb_apu_tick(GameBoy *gb, u32 cycles)
+{
+    APU *apu = &gb->apu;
+    while (cycles > 0) {
+        u32 step = cycles < APU_FRAME_SEQ_CYCLES ? cycles : APU_FRAME_SEQ_CYCLES;
+        if (apu->enabled) {
+            if (apu->seq_timer < step) step = apu->seq_timer;
+            for (int c = 0; c < 4 && apu->sample_rate; c++) {
+                if (apu_channel_audible(gb, c) && apu->ch[c].timer < step) step = apu->ch[c].timer;
+            }
+
+            for (int c = 0; c < 4; c++) apu_channel_advance(gb, c, step);
+            apu->seq_timer -= step;
+            if (apu->seq_timer == 0) {
+                apu->seq_timer = APU_FRAME_SEQ_CYCLES;
+                apu_frame_sequencer(gb);
             }
         }
+        apu->clock += step;
+        cycles -= step;
+        if (apu->enabled) apu_update_status(gb);
+
+        // Keep the most recent audio when the samples are not being read
+        if (apu->sample_rate &&
+            ((apu->blip.offset + (u64)apu->clock * apu->factor) >> 32) >= BLIP_SIZE*3/4) {
+            apu_read_samples(apu, NULL, BLIP_SIZE/2);
+        }
+    }
+}
+
+// NR52 reads come straight from memory: the status has to be current when a
+// length timer or the sweep may turn a channel off
+static void apu_schedule_status(APU *apu)
+{
+    bool timed = apu->sweep_enabled && apu->ch[0].enabled;
+    for (int c = 0; c < 4; c++) {
+        if (apu->ch[c].enabled && apu->ch[c].length_enabled) timed = true;
     }
+    apu->status_at = apu->enabled && timed ? apu->synced + apu->seq_timer : UINT64_MAX;
+}
 
-    while (ppu->scanline_timer <= 0.0) {
-        ppu->scanline_started = false;
-        ppu->scanline_timer += scanline_time;
-        //printf("%10lf:   Scanline %d end\n\n", elapsed, ppu->scanline);
-        ppu->scanline = (ppu->scanline + 1) % 154;
+// Catches up with the CPU
+void gb_apu_sync(GameBoy *gb)
+{
+    APU *apu = &gb->apu;
+    while (apu->synced < gb->elapsed_cycles) {
+        u64 cycles = gb->elapsed_cycles - apu->synced;
+        if (cycles > UINT32_MAX) cycles = UINT32_MAX;
+        gb_apu_tick(gb, (u32)cycles);
+        apu->synced += cycles;
     }
+    apu_schedule_status(apu);
+}
 
-    while (ppu->frame_timer <= 0.0) {
-        ppu->frame_started = false;
-        ppu->frame_timer += frame_time;
-        //printf("%10lf: Frame %ld end\n", elapsed, ppu->frame);
-        //printf("=======================================\n");
-        ppu->frame += 1;
+void gb_apu_write(GameBoy *gb, u16 addr, u8 value)
+{
+    bool is_ch1 = addr >= rNR10 && addr <= rNR14;
+    bool is_ch2 = addr >= rNR21 && addr <= rNR24;
+    bool is_ch3 = addr >= rNR30 && addr <= rNR34;
+    bool is_ch4 = addr >= rNR41 && addr <= rNR44;
+    bool is_wave = addr >= 0xff30 && addr <= 0xff3f;
+    assert(is_ch1 || is_ch2 || is_ch3 || is_ch4 || is_wave ||
+        addr == rNR50 || addr == rNR51 || addr == rNR52);
+
+    APU *apu = &gb->apu;
+    gb_apu_sync(gb);
+
+    // While powered off, only NR52 and the wave RAM are writable
+    if (!apu->enabled && addr != rNR52 && !is_wave) return;
+
+    int c = is_ch1 ? 0 : is_ch2 ? 1 : is_ch3 ? 2 : 3;
+    if (addr == rNR52) {
+        bool on = value & 0x80;
+        if (!on && apu->enabled) {
+            // Powering off clears every register and channel
+            memset(gb->memory + rNR10, 0, rNR52 - rNR10);
+            memset(apu->ch, 0, sizeof(apu->ch));
+            apu->sweep_enabled = false;
+        } else if (on && !apu->enabled) {
+            apu->seq_step = 0;
+            apu->seq_timer = APU_FRAME_SEQ_CYCLES;
+        }
+        apu->enabled = on;
+    } else {
+        gb->memory[addr] = value;
     }
 
-    // Update I/O registers
-    gb->memory[rLY] = ppu->scanline;
+    if (addr == APU_NRX1[c]) {
+        apu->ch[c].length = c == 2 ? 256 - value : 64 - (value & 0x3F);
+    } else if (addr == rNR30) {
+        apu->ch[2].dac = value & 0x80;
+        if (!apu->ch[2].dac) apu->ch[2].enabled = false;
+    } else if (addr == APU_NRX2[c] && c != 2) {
+        apu->ch[c].dac = (value & 0xF8) != 0;
+        if (!apu->ch[c].dac) apu->ch[c].enabled = false;
+    } else if (addr == APU_NRX3[c]) {
+        apu_update_period(gb, c);
+    } else if (addr == APU_NRX4[c]) {
+        apu->ch[c].length_enabled = value & 0x40;
+        if (value & 0x80) apu_trigger(gb, c);
+        else apu_update_period(gb, c);
+    }
+    apu_update_status(gb);
+    apu_schedule_status(apu);
 
-    gb->memory[rSTAT] &= ~0x3;
-    gb->memory[rSTAT] |= gb->ppu.mode;
+    if (addr == rNR52 && value == 0 && gb->serial_idx > 0) {
+        // The host decides what to do with the result (see gb_headless.c).
+        // Without a printf (e.g. batch runs) the serial log stays quiet.
+        size_t len = strlen("Passed\n");
+        const char *passed_part = gb->serial_buffer + gb->serial_idx - len;
+        if (gb->serial_idx > len && strncmp(passed_part, "Passed\n", len) == 0) {
+            gb->status = GB_STATUS_PASSED;
+        } else {
+            for (int i = 0; i + 6 <= gb->serial_idx; i++) {
+                if (strncmp(gb->serial_buffer + i, "Failed", 6) == 0) gb->status = GB_STATUS_FAILED;
+            }
+        }
 
-    // Update Interrupt Flags register
-    if (gb->memory[rLY] == gb->memory[rLYC]) {
-        gb->memory[rSTAT] |= 0x04;
+        if (gb->printf == NULL) return;
+        for (int i = 0; i < gb->serial_idx; i++) {
+            char c = gb->serial_buffer[i];
+            if (c < ' ' || c > '~') c = '.';
+            gb->printf("%c", c);
+        }
+        gb->printf("\n");
+        if (gb->status == GB_STATUS_PASSED) gb->printf("Passed\n");
+        else gb->printf("Failed at $%04x\n", gb->PC);
     }
 }
 
+void gb_apu_set_sample_rate(GameBoy *gb, u32 sample_rate)
+{
+    APU *apu = &gb->apu;
+    gb_apu_sync(gb);
+    apu->sample_rate = sample_rate;
+    apu->factor = (u64)((f64)sample_rate * 4294967296.0 / CPU_FREQ + 0.5);
+    apu->clock = 0;
+    apu->out_l = apu->out_r = 0.0f;
+    memset(&apu->blip, 0, sizeof(apu->blip));
+    blip_init_kernel(apu);
+    apu_mix(gb);
+}
+
+// Scales the output rate by ratio, within APU_MAX_RATE_ADJUST. Frontends use it
+// to keep their audio buffer level steady against the device clock.
+void gb_apu_set_rate_ratio(GameBoy *gb, f64 ratio)
+{
+    APU *apu = &gb->apu;
+    if (apu->sample_rate == 0) return;
+    if (ratio < 1.0 - APU_MAX_RATE_ADJUST) ratio = 1.0 - APU_MAX_RATE_ADJUST;
+    if (ratio > 1.0 + APU_MAX_RATE_ADJUST) ratio = 1.0 + APU_MAX_RATE_ADJUST;
+
+    // Samples already synthesized keep their position
+    gb_apu_sync(gb);
+    apu_end_frame(apu);
+    apu->factor = (u64)(apu->sample_rate * ratio * 4294967296.0 / CPU_FREQ + 0.5);
+}
+
+// Reads up to max_frames interleaved stereo samples produced since the last
+// call. A NULL out discards them.
+size_t gb_apu_read_samples(GameBoy *gb, f32 *out, size_t max_frames)
+{
+    if (gb->apu.sample_rate == 0) return 0;
+    gb_apu_sync(gb);
+    return apu_read_samples(&gb->apu, out, max_frames);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Audio Ring Buffer                                //
+///////////////////////////////////////////////////////////////////////////////
+// Head and tail only ever grow (modulo 2^32), each is written by one side only.
+// The release store of an index publishes the frames copied before it.
+#define AUDIO_RING_MASK (AUDIO_RING_SIZE - 1)
+
+void audio_ring_set_latency(Audio_Ring *ring, u32 frames)
+{
+    if (frames > AUDIO_RING_SIZE) frames = AUDIO_RING_SIZE;
+    atomic_store_explicit(&ring->latency, frames, memory_order_relaxed);
+}
+
+u32 audio_ring_fill(Audio_Ring *ring)
+{
+    u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+// Producer side. Returns the number of frames queued, the rest is dropped.
+size_t audio_ring_push(Audio_Ring *ring, const f32 *frames, size_t count)
+{
+    u32 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    u32 latency = atomic_load_explicit(&ring->latency, memory_order_relaxed);
+    u32 fill = head - tail;
+    u32 room = latency > fill ? latency - fill : 0;
+    if (count > room) {
+        atomic_fetch_add_explicit(&ring->overruns, count - room, memory_order_relaxed);
+        count = room;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        u32 idx = (head + i) & AUDIO_RING_MASK;
+        ring->buf[2*idx + 0] = frames[2*i + 0];
+        ring->buf[2*idx + 1] = frames[2*i + 1];
+    }
+    atomic_store_explicit(&ring->head, head + (u32)count, memory_order_release);
+    return count;
+}
+
+// Consumer side. Always fills count frames, with silence past the queued ones.
+size_t audio_ring_pop(Audio_Ring *ring, f32 *out, size_t count)
+{
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    u32 avail = head - tail;
+    size_t n = count < avail ? count : avail;
+
+    for (size_t i = 0; i < n; i++) {
+        u32 idx = (tail + i) & AUDIO_RING_MASK;
+        out[2*i + 0] = ring->buf[2*idx + 0];
+        out[2*i + 1] = ring->buf[2*idx + 1];
+    }
+    atomic_store_explicit(&ring->tail, tail + (u32)n, memory_order_release);
+
+    if (n < count) {
+        memset(out + 2*n, 0, (count - n) * 2 * sizeof(out[0]));
+        atomic_fetch_add_explicit(&ring->underruns, count - n, memory_order_relaxed);
+    }
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Frame Triple Buffer                              //
+///////////////////////////////////////////////////////////////////////////////
+// Each side owns one buffer and swaps it with the middle one. The acq_rel
+// exchange publishes the pixels drawn before it and acquires those read after.
+void frame_buffer_init(Frame_Buffer *fb)
+{
+    fb->back = 0;
+    atomic_store(&fb->middle, 1);
+    fb->front = 2;
+    atomic_store(&fb->published, 0);
+    atomic_store(&fb->dropped, 0);
+}
+
+// Producer side: where the next frame goes
+Color *frame_buffer_back(Frame_Buffer *fb)
+{
+    return fb->frames[fb->back];
+}
+
+// Producer side: the back buffer holds a complete frame
+void frame_buffer_publish(Frame_Buffer *fb)
+{
+    u8 prev = atomic_exchange_explicit(&fb->middle, fb->back | FRAME_BUFFER_FRESH, memory_order_acq_rel);
+    if (prev & FRAME_BUFFER_FRESH) atomic_fetch_add_explicit(&fb->dropped, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&fb->published, 1, memory_order_relaxed);
+    fb->back = prev & ~FRAME_BUFFER_FRESH;
+}
+
+// Consumer side: the newest frame, or NULL if none arrived since the last read
+const Color *frame_buffer_read(Frame_Buffer *fb)
+{
+    if ((atomic_load_explicit(&fb->middle, memory_order_relaxed) & FRAME_BUFFER_FRESH) == 0) return NULL;
+    u8 prev = atomic_exchange_explicit(&fb->middle, fb->front, memory_order_acq_rel);
+    fb->front = prev & ~FRAME_BUFFER_FRESH;
+    return fb->frames[fb->front];
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 //                          Utils/Debug                                      //
 ///////////////////////////////////////////////////////////////////////////////
+const char *gb_status_str(GB_Status status)
+{
+    switch (status) {
+        case GB_STATUS_OK:         return "OK";
+        case GB_STATUS_PASSED:     return "PASSED";
+        case GB_STATUS_FAILED:     return "FAILED";
+        case GB_STATUS_ILLEGAL_OP: return "ILLEGAL_OP";
+        case GB_STATUS_BAD_ROM:    return "BAD_ROM";
+        case GB_STATUS_IO_ERROR:   return "IO_ERROR";
+        default: assert(0 && "Invalid status");
+    }
+    return "UNKNOWN";
+}
+
 void gb_dump(const GameBoy *gb)
 {
     gb->printf("$PC: $%04X, A: $%02X, F: %c%c%c%c, "
@@ -2453,7 +3452,7 @@ void gb_disassemble(const void *rom, size_t size)
     u16 addr = 0x0000;
     const u8 *pc = (const u8*)rom;
     while (size > 0) {
-        Inst inst = gb_fetch_internal(pc, 0, false);
+        Inst inst = gb_fetch_internal(pc, 0);
         printf("%04x: ", addr);
         if (inst.size == 1) printf("%02x           ", inst.data[0]);
         if (inst.size == 2) printf("%02x %02x        ", inst.data[0], inst.data[1]);
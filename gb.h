@@ -2,6 +2,7 @@
 #define GB_H
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -11,6 +12,7 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
+typedef int16_t  s16;
 typedef int64_t  s64;
 
 typedef float  f32;
@@ -65,6 +67,8 @@ extern const Color PALETTE[4];
 #define VIEWPORT_ROWS 18
 #define TILE_PIXELS 8
 #define OAM_COUNT 40
+#define OBJS_PER_LINE 10  // Max. number of objects selected by the OAM scan on each line
+#define GB_MAX_BREAKPOINTS 16
 
 #define rP1     0xFF00 // Joypad
 #define rSB     0xFF01 // Serial transfer data
@@ -127,6 +131,7 @@ extern const Color PALETTE[4];
 #define _RAM        0xC000
 #define _OAMRAM     0xFE00
 #define _IO         0xFF00
+#define _AUD3WAVERAM 0xFF30 // Wave pattern RAM (32 4-bit samples)
 #define _HRAM       0xFF80
 
 #define LCDCF_OFF       0x00  // LCDC.7: LCD Control
@@ -157,6 +162,13 @@ extern const Color PALETTE[4];
 #define STATF_LCD       0x03  // %00000011 ; Both OAM and VRAM used by system
 #define STATF_BUSY      0x02  // %00000010 ; When set, VRAM access is unsafe
 
+#define TACF_START      0x04  // %00000100 ; Timer enable
+#define TACF_STOP       0x00  // %00000000
+#define TACF_4KHZ       0x00  // %00000000 ; 4096 Hz
+#define TACF_262KHZ     0x01  // %00000001 ; 262144 Hz
+#define TACF_65KHZ      0x02  // %00000010 ; 65536 Hz
+#define TACF_16KHZ      0x03  // %00000011 ; 16384 Hz
+
 #define IEF_HILO        0x10  // %00010000 ; Transition from High to Low of Pin number P10-P13
 #define IEF_SERIAL      0x08  // %00001000 ; Serial I/O transfer end
 #define IEF_TIMER       0x04  // %00000100 ; Timer Overflow
@@ -182,22 +194,140 @@ typedef enum PPU_Mode {
     PM_DRAWING = 3,
 } PPU_Mode;
 
-typedef struct PPU {
-    bool frame_started;
-    bool scanline_started;
+// Which frames produce pixels. The PPU timing (LY, STAT, modes, interrupts)
+// advances the same way regardless of the policy.
+typedef enum Render_Policy {
+    RP_ALWAYS = 0,  // Every frame
+    RP_EVERY_NTH,   // One frame out of render_interval
+    RP_ON_REQUEST,  // Only frames requested with gb_request_frame
+} Render_Policy;
+
+// Inputs of a line as it was last drawn into display. A line whose inputs are
+// unchanged would come out identical and is not drawn again.
+typedef struct PPU_Line_State {
+    bool valid;
+    u32 mem_gen;
+    u8 lcdc, scy, scx, wy, wx, bgp, obp0, obp1;
+    u8 window_line;
+} PPU_Line_State;
 
-    u64 frame;
+typedef struct PPU {
+    bool enabled;   // Follows LCDC.7, the PPU restarts from line 0 when turned on
+    u64 frame;      // Completed frames, counted when VBlank starts
     u32 scanline;
-    u32 dot;
+    u32 dot;        // Dot (T-cycle) within the current scanline
     PPU_Mode mode;
+    bool stat_line; // OR of the selected STAT interrupt conditions
 
-    int scanline_mode_count;
+    // Result of the OAM scan (mode 2) for the current line:
+    // OAM indices of up to 10 objects sorted by drawing priority (X, then OAM index)
+    u8 line_objs[OBJS_PER_LINE];
+    u8 line_obj_count;
 
-    f64 frame_timer;
-    f64 scanline_timer;
-    f64 dot_timer;
+    u8 window_line; // Internal line counter of the window (only advances when drawn)
+
+    Render_Policy render_policy;
+    u32 render_interval;   // N for RP_EVERY_NTH
+    bool render_requested; // Cleared once the requested frame has been drawn
+    bool frame_rendering;  // Whether the current frame is drawn into display
+
+    u32 mem_gen; // Bumped on every VRAM/OAM write (including OAM DMA)
+    PPU_Line_State line_state[SCRN_Y];
+    bool lines_changed; // Some line of the current frame was drawn differently
+    bool frame_changed; // A completed frame changed display (cleared by the consumer)
 } PPU;
 
+// APU timing, in T-cycles
+#define APU_FRAME_SEQ_CYCLES 8192 // 512 Hz frame sequencer (length, sweep, envelope)
+#define APU_MAX_RATE_ADJUST  0.005 // Max. deviation of gb_apu_set_rate_ratio (±0.5%)
+
+// Band-limited step synthesis (blip buffer). Amplitude changes are added as
+// windowed-sinc impulses at their exact output time and integrated on read.
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS) // Sub-sample positions of the impulse kernel
+#define BLIP_WIDTH  16   // Taps of the impulse kernel
+#define BLIP_SIZE   4096 // Stereo frames buffered (~85 ms at 48 kHz)
+
+// Both sides share their timing, so they are interleaved (L, R): a change of
+// the output is a single vectorized pass over 2*BLIP_WIDTH floats.
+typedef struct Blip {
+    u64 offset;        // Output frame of APU.clock 0 (32.32 fixed point)
+    f32 integrator[2]; // Running sums, i.e. the current amplitudes
+    f32 buf[2*(BLIP_SIZE + BLIP_WIDTH)];
+} Blip;
+
+typedef struct APU_Channel {
+    bool enabled;        // Reported in NR52, cleared by the length timer or the DAC
+    bool dac;            // Square/noise: NRx2 & $F8, wave: NR30.7
+    u32 period;          // T-cycles per waveform step
+    u32 timer;           // T-cycles until the next waveform step
+    u8 pos;              // Duty step (0-7) or wave sample (0-31)
+    u16 lfsr;            // Noise shift register
+    u16 length;          // Length timer, the channel stops when it reaches 0
+    bool length_enabled;
+    u8 volume;           // Envelope volume (0-15)
+    u8 env_period;       // Envelope pace in frame sequencer steps (0: off)
+    u8 env_timer;
+    bool env_up;
+    u8 output;           // Digital output (0-15)
+} APU_Channel;
+
+typedef struct APU {
+    bool enabled;        // NR52.7
+    APU_Channel ch[4];   // Square 1 (with sweep), square 2, wave, noise
+    u32 seq_timer;       // T-cycles until the next frame sequencer step
+    u8 seq_step;         // 0-7
+
+    // Channel 1 frequency sweep
+    bool sweep_enabled;
+    u8 sweep_timer;
+    u16 sweep_freq;      // Shadow frequency
+
+    // The APU runs lazily: it catches up with the CPU on register writes, on
+    // reads of the samples and whenever NR52 could change (status_at)
+    u64 synced;          // GameBoy.elapsed_cycles the APU has been run to
+    u64 status_at;       // Cycle of the next length/sweep clock that may stop a channel
+
+    // Output, only synthesized when sample_rate is set
+    u32 sample_rate;
+    u64 factor;          // Output samples per T-cycle (32.32 fixed point)
+    u32 clock;           // T-cycles since the last gb_apu_read_samples
+    f32 out_l, out_r;    // Amplitude last added to the blip buffer
+    Blip blip;
+    f32 kernel[BLIP_PHASES][2*BLIP_WIDTH]; // Every tap twice, to match the interleaving
+} APU;
+
+// Single-producer/single-consumer queue of stereo frames between the emulation
+// and the audio callback. Neither side ever waits: the producer drops what
+// exceeds the latency (overrun), the consumer plays silence when empty (underrun).
+// What each side writes is on its own cache line, so that a push does not
+// invalidate the line the consumer polls (and vice versa).
+#define AUDIO_RING_SIZE 8192 // Stereo frames, power of two
+
+typedef struct Audio_Ring {
+    f32 buf[AUDIO_RING_SIZE * 2];
+    _Alignas(64) _Atomic u32 head; // Frames pushed (producer)
+    _Atomic u64 overruns;          // Frames dropped
+    _Atomic u32 latency;           // Max. frames queued
+    _Alignas(64) _Atomic u32 tail; // Frames popped (consumer)
+    _Atomic u64 underruns;         // Frames of silence played
+} Audio_Ring;
+
+// Triple buffer of video frames between the emulation and the presenter. The
+// producer always has a buffer to draw into and the consumer always gets the
+// newest complete frame; neither side ever waits. The buffers swap roles
+// through the atomic middle index.
+#define FRAME_BUFFER_FRESH 4 // Set in middle while its frame has not been read
+
+typedef struct Frame_Buffer {
+    Color frames[3][SCRN_X*SCRN_Y];
+    u8 back;                // Being drawn (producer)
+    u8 front;               // Last read (consumer)
+    _Atomic u8 middle;      // Last published, | FRAME_BUFFER_FRESH if unread
+    _Atomic u64 published;  // Frames published
+    _Atomic u64 dropped;    // Frames overwritten before being read
+} Frame_Buffer;
+
 typedef struct ROM_Header {
     u8 entry[4];       // 0100-0103 (4)
     u8 logo[48];       // 0104-0133 (48)
@@ -224,6 +354,17 @@ typedef enum RW_Op {
     RW_W_MEM    = 4,
 } RW_Op;
 
+// Outcome of loading or running a ROM. The core never exits the process, it
+// records the status on the instance and leaves the decision to the host.
+typedef enum GB_Status {
+    GB_STATUS_OK         = 0, // Loaded and running
+    GB_STATUS_PASSED     = 1, // Test ROM reported "Passed" over serial
+    GB_STATUS_FAILED     = 2, // Test ROM reported "Failed" over serial
+    GB_STATUS_ILLEGAL_OP = 3, // CPU locked up on an illegal opcode
+    GB_STATUS_BAD_ROM    = 4, // Bad header or unsupported cartridge
+    GB_STATUS_IO_ERROR   = 5, // ROM could not be read
+} GB_Status;
+
 typedef enum Reg8 {
     REG_B = 0,
     REG_C = 1,
@@ -277,6 +418,8 @@ typedef struct Inst {
     Opcode opcode;
 } Inst;
 
+typedef struct GB_Link GB_Link;
+
 typedef struct GameBoy {
     // CPU freq:        4.194304 MHz    (~4194304 cycles/s)
     // Horizontal sync: 9.198 KHz       ( 0.10871929 ms/line)
@@ -295,7 +438,8 @@ typedef struct GameBoy {
     // Tiles are 8x8 pixels (also called patterns or characters)
     // Stored with color ID's from 0 to 3 or 2 bits per pixel
     // 8x8x2 = 128 bits = 16 bytes/tile
-    Color display[SCRN_VX*SCRN_VY]; // 256x256 pixels
+    // BG, window and objects are composed line by line into the LCD output
+    Color display[SCRN_X*SCRN_Y]; // 160x144 pixels
 
     // 0000-3FFF    16 KiB ROM bank 00
     // 4000-7FFF    16 KiB ROM bank 01~NN
@@ -332,9 +476,12 @@ typedef struct GameBoy {
     u8 dpad_right;
 
     PPU ppu;
+    APU apu;
 
     char serial_buffer[256];
     u8 serial_idx;
+    u32 serial_cycles;  // T-cycles until the transfer in progress completes (0: none)
+    GB_Link *link;      // Link cable to another instance (NULL: unplugged)
 
     // Timers
     Timer timer;
@@ -349,11 +496,8 @@ typedef struct GameBoy {
 
     u64 elapsed_cycles; // 4194304 cycles/s
     u64 elapsed_us;     // Microseconds elapsed since the start
-    f64 elapsed_ms;     // Milliseconds elapsed since the start
-    f64 timer_clock;
-    f64 timer_div;   // Ticks at 16384Hz (in ms)
-    f64 timer_tima;  // Ticks at 4096/262144/65536/16384 Hz (depending on TAC)
-    f64 timer_ly;    // Ticks at ~9180 Hz (every 0.1089 ms)
+    u16 div_counter; // Internal divider (T-cycles), DIV is its upper byte
+    u8 tima_reload;  // T-cycles until TMA is loaded into TIMA after an overflow (0: none)
 
     int (*printf)(const char *fmt, ...);
 
@@ -362,18 +506,79 @@ typedef struct GameBoy {
     bool stopped;
     bool running;
     bool paused;
+    bool initialized;   // gb_init has run (done by the first gb_update)
+    GB_Status status;
+
+    // Debugging
+    bool infinite_loop; // A jump to itself was detected
+    u16 breakpoints[GB_MAX_BREAKPOINTS];
+    u8 breakpoint_count;
 } GameBoy;
 
+// Joypad state as one byte, same bit order as the P1 register (buttons low)
+#define GB_BUTTON_A         0x01
+#define GB_BUTTON_B         0x02
+#define GB_BUTTON_SELECT    0x04
+#define GB_BUTTON_START     0x08
+#define GB_BUTTON_RIGHT     0x10
+#define GB_BUTTON_LEFT      0x20
+#define GB_BUTTON_UP        0x40
+#define GB_BUTTON_DOWN      0x80
+
+// Many instances of one ROM stepped in lockstep (e.g. RL environments). The
+// ROM is loaded once and shared read-only. The registers of every instance
+// are mirrored as structure-of-arrays after each step, so a host can read
+// them for the whole batch without touching the (large) GameBoy structs.
+typedef struct GB_Batch {
+    u32 count;
+    GameBoy *envs;      // count instances in one allocation
+    GameBoy *initial;   // State right after loading, restored by gb_batch_reset
+    u8 *rom;            // Shared by all instances, never written
+
+    u16 *pc, *sp, *af, *bc, *de, *hl;
+    GB_Status *status;
+    u64 *frame_start;   // ppu.frame when the current step started
+    u32 *frame_cycles;  // Cycles run in the current step
+} GB_Batch;
+
+// Preallocated instance slots for one ROM, recycled instead of freed. Slots,
+// ROM and the loaded state live in one mapping (on huge pages if requested),
+// every slot starts on a cache line. Acquiring a slot resets it with
+// gb_reset_from, which copies only what a run can change.
+#define GB_POOL_CACHE_LINE  64
+#define GB_POOL_HUGE_PAGES  0x01
+
+typedef struct GB_Pool {
+    u32 count;
+    size_t stride;      // Bytes between slots, sizeof(GameBoy) rounded up to a cache line
+    u8 *slots;
+    GameBoy *initial;   // State right after loading
+    u8 *rom;            // Shared by all slots, never written
+    u32 *free_slots;    // Stack of free slot indices
+    u32 free_count;
+    size_t mapped;      // Size of the mapping
+    bool huge_pages;    // The mapping uses explicit huge pages
+} GB_Pool;
+
+// Link cable between two instances in one process. Both sides are stepped
+// interleaved on the calling thread and only synchronize every quantum
+// T-cycles, or exactly when a transfer is about to complete.
+struct GB_Link {
+    GameBoy *gb[2];
+    u32 quantum;        // Max. T-cycles one side runs ahead of the other
+    u64 cycles[2];      // T-cycles run by each side since they were connected
+};
+
 
 // GameBoy
-void gb_init_with_args(GameBoy *gb, int argc, char **argv);
+GB_Status gb_init_with_args(GameBoy *gb, int argc, char **argv);
 void gb_init(GameBoy *gb);
+void gb_reset_from(GameBoy *gb, const GameBoy *initial);
 void gb_clock_step(GameBoy *gb);
 void gb_update(GameBoy *gb);
 int gb_exec(GameBoy *gb, Inst inst);
 
 // CPU
-void cpu_update(GameBoy *gb);
 
 #define UNCHANGED (-1)
 u8 gb_get_flag(const GameBoy *gb, Flag flag);
@@ -386,27 +591,78 @@ void gb_set_reg(GameBoy *gb, Reg8 r8, u8 value);
 void gb_set_reg16(GameBoy *gb, Reg16 r16, u16 value);
 
 Inst gb_fetch(const GameBoy *gb);
-Inst gb_fetch_internal(const u8 *data, u8 flags, bool exit_illegal_inst);
+bool gb_is_illegal_opcode(u8 b);
+Inst gb_fetch_internal(const u8 *data, u8 flags);
 const char *gb_decode(Inst inst, char *buf, size_t size);
 
+u32 gb_step(GameBoy *gb);
 void gb_tick_ms(GameBoy *gb, f64 dt_ms);
 void gb_tick_us(GameBoy *gb, u64 dt_us);
+u32 gb_run_frame(GameBoy *gb);
+void gb_set_buttons(GameBoy *gb, u8 buttons);
+
+// Batch
+GB_Status gb_batch_init(GB_Batch *batch, u8 *raw, size_t size, u32 count);
+void gb_batch_free(GB_Batch *batch);
+void gb_batch_reset(GB_Batch *batch, u32 i);
+void gb_batch_step(GB_Batch *batch, const u8 *actions, u32 n);
+
+// Pool
+GB_Status gb_pool_init(GB_Pool *pool, u8 *raw, size_t size, u32 count, u32 flags);
+void gb_pool_free(GB_Pool *pool);
+GameBoy *gb_pool_acquire(GB_Pool *pool);
+void gb_pool_release(GB_Pool *pool, GameBoy *gb);
+
+// Serial link
+void gb_link_connect(GB_Link *link, GameBoy *a, GameBoy *b, u32 quantum);
+void gb_link_disconnect(GB_Link *link);
+void gb_link_run(GB_Link *link, u64 cycles);
+void gb_serial_tick(GameBoy *gb, u32 cycles);
+
+// Timer unit (DIV, TIMA, TMA, TAC)
+void gb_timer_tick(GameBoy *gb, u32 cycles);
+u32 gb_timer_cycles_to_irq(const GameBoy *gb);
 
 // PPU
 void ppu_init(PPU *ppu);
-void ppu_update(GameBoy *gb);
-
+void ppu_tick(GameBoy *gb, u32 cycles);
+u32 ppu_cycles_to_event(const GameBoy *gb);
+void ppu_stat_write(GameBoy *gb, u16 addr, u8 value);
+void ppu_oam_scan(GameBoy *gb, int ly);
+void gb_set_render_policy(GameBoy *gb, Render_Policy policy, u32 interval);
+void gb_request_frame(GameBoy *gb);
+
+void gb_render_line(GameBoy *gb, int ly);
 void gb_render(GameBoy *gb);
+void gb_render_bg_map(const GameBoy *gb, Color *pixels);
 
 // Memory Bus
 u8 gb_mem_read(const GameBoy *gb, u16 addr);
 void gb_mem_write(GameBoy *gb, u16 addr, u8 value);
 
 // Cartridge
-void gb_load_rom_file(GameBoy *gb, const char *path);
-void gb_load_rom(GameBoy *gb, u8 *raw, size_t size);
+GB_Status gb_load_rom_file(GameBoy *gb, const char *path);
+GB_Status gb_load_rom(GameBoy *gb, u8 *raw, size_t size);
 
 // APU
+void gb_apu_tick(GameBoy *gb, u32 cycles);
+void gb_apu_sync(GameBoy *gb);
+void gb_apu_write(GameBoy *gb, u16 addr, u8 value);
+void gb_apu_set_sample_rate(GameBoy *gb, u32 sample_rate);
+void gb_apu_set_rate_ratio(GameBoy *gb, f64 ratio);
+size_t gb_apu_read_samples(GameBoy *gb, f32 *out, size_t max_frames);
+
+// Audio ring buffer
+void audio_ring_set_latency(Audio_Ring *ring, u32 frames);
+u32 audio_ring_fill(Audio_Ring *ring);
+size_t audio_ring_push(Audio_Ring *ring, const f32 *frames, size_t count);
+size_t audio_ring_pop(Audio_Ring *ring, f32 *out, size_t count);
+
+// Frame triple buffer
+void frame_buffer_init(Frame_Buffer *fb);
+Color *frame_buffer_back(Frame_Buffer *fb);
+void frame_buffer_publish(Frame_Buffer *fb);
+const Color *frame_buffer_read(Frame_Buffer *fb);
 
 // Timer
 void timer_init(Timer *timer);
@@ -414,6 +670,7 @@ void timer_update(Timer *timer);
 
 // Utils/Debug
 void gb_dump(const GameBoy *gb);
+const char *gb_status_str(GB_Status status);
 
 // Assembler
 typedef enum Token_Type {
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE // pthread_setaffinity_np, sched_getaffinity
+#include <glob.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gb.h"
+
+// Runs many ROMs at once, each in its own GameBoy instance, as fast as the host
+// allows. Jobs are spread over one deque per worker; a worker takes jobs from
+// the front of its own deque and, once it runs dry, steals from the back of
+// the others, so a few slow ROMs don't leave the remaining cores idle.
+//
+// With --pin every worker is bound to one CPU (in order from --cpus, or from
+// the CPUs the process may run on). Instances are allocated by the worker
+// that runs them, after pinning, so with the kernel's first-touch policy
+// their pages land on the worker's NUMA node and stay there.
+
+#define BATCH_MAX_WORKERS 256
+
+typedef enum Batch_Result {
+    BR_PASSED,
+    BR_FAILED,
+    BR_TIMEOUT,
+    BR_ILLEGAL_OP,
+    BR_BAD_ROM,
+    BR_IO_ERROR,
+} Batch_Result;
+
+static const char *BATCH_RESULT_STR[] = {
+    [BR_PASSED]     = "PASSED",
+    [BR_FAILED]     = "FAILED",
+    [BR_TIMEOUT]    = "TIMEOUT",
+    [BR_ILLEGAL_OP] = "ILLEGAL_OP",
+    [BR_BAD_ROM]    = "BAD_ROM",
+    [BR_IO_ERROR]   = "IO_ERROR",
+};
+
+typedef struct Batch_Job {
+    const char *path;
+    Batch_Result result;
+    u64 cycles;     // Emulated T-cycles
+    f64 seconds;    // Host time
+    u32 worker;
+} Batch_Job;
+
+typedef struct Batch Batch;
+
+typedef struct Batch_Worker {
+    Batch *batch;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    u32 *queue;     // Job indices, taken from [head, tail)
+    u32 head;
+    u32 tail;
+    u32 id;
+    int cpu;        // Pinned to, or -1
+
+    // Throughput, only written by the worker itself
+    u32 jobs_run;
+    u64 cycles;     // Emulated T-cycles
+    f64 busy;       // Host seconds spent running jobs
+} Batch_Worker;
+
+struct Batch {
+    Batch_Job *jobs;
+    u32 job_count;
+    Batch_Worker workers[BATCH_MAX_WORKERS];
+    u32 worker_count;
+    u64 timeout_cycles;
+    bool pin;
+    int cpus[BATCH_MAX_WORKERS];
+    u32 cpu_count;
+};
+
+static f64 batch_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void batch_run_job(Batch *batch, Batch_Job *job)
+{
+    f64 start = batch_now();
+    GameBoy *gb = calloc(1, sizeof(GameBoy));
+    assert(gb);
+
+    GB_Status status = gb_load_rom_file(gb, job->path);
+    if (status == GB_STATUS_OK) {
+        gb_init(gb);
+        gb_set_render_policy(gb, RP_ON_REQUEST, 0); // No pixels needed
+        gb->running = true;
+        while (gb->status == GB_STATUS_OK && gb->elapsed_cycles < batch->timeout_cycles) {
+            gb_run_frame(gb);
+        }
+        status = gb->status;
+    }
+
+    switch (status) {
+        case GB_STATUS_OK:         job->result = BR_TIMEOUT; break;
+        case GB_STATUS_PASSED:     job->result = BR_PASSED; break;
+        case GB_STATUS_FAILED:     job->result = BR_FAILED; break;
+        case GB_STATUS_ILLEGAL_OP: job->result = BR_ILLEGAL_OP; break;
+        case GB_STATUS_BAD_ROM:    job->result = BR_BAD_ROM; break;
+        case GB_STATUS_IO_ERROR:   job->result = BR_IO_ERROR; break;
+        default: assert(0 && "Unreachable");
+    }
+    job->cycles = gb->elapsed_cycles;
+    job->seconds = batch_now() - start;
+
+    free(gb->rom);
+    free(gb);
+}
+
+// Own jobs come from the front, stolen ones from the back
+static bool batch_take(Batch_Worker *worker, bool steal, u32 *job)
+{
+    bool found = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head < worker->tail) {
+        *job = steal ? worker->queue[--worker->tail] : worker->queue[worker->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static void *batch_worker(void *arg)
+{
+    Batch_Worker *self = arg;
+    Batch *batch = self->batch;
+
+    self->cpu = -1;
+    if (batch->pin) {
+        int cpu = batch->cpus[self->id % batch->cpu_count];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+            self->cpu = cpu;
+        } else {
+            fprintf(stderr, "Failed to pin worker %u to CPU %d\n", self->id, cpu);
+        }
+    }
+
+    for (;;) {
+        u32 job;
+        bool found = batch_take(self, false, &job);
+        for (u32 i = 1; !found && i < batch->worker_count; i++) {
+            found = batch_take(&batch->workers[(self->id + i) % batch->worker_count], true, &job);
+        }
+        // Jobs are never added once started, so empty queues mean we're done
+        if (!found) break;
+
+        Batch_Job *j = &batch->jobs[job];
+        j->worker = self->id;
+        batch_run_job(batch, j);
+        self->jobs_run += 1;
+        self->cycles += j->cycles;
+        self->busy += j->seconds;
+    }
+    return NULL;
+}
+
+static void batch_run(Batch *batch)
+{
+    // Deal the jobs round-robin
+    for (u32 w = 0; w < batch->worker_count; w++) {
+        Batch_Worker *worker = &batch->workers[w];
+        worker->batch = batch;
+        worker->id = w;
+        worker->queue = malloc((batch->job_count / batch->worker_count + 1) * sizeof(u32));
+        assert(worker->queue);
+        worker->head = worker->tail = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for (u32 i = 0; i < batch->job_count; i++) {
+        Batch_Worker *worker = &batch->workers[i % batch->worker_count];
+        worker->queue[worker->tail++] = i;
+    }
+
+    for (u32 w = 0; w < batch->worker_count; w++) {
+        pthread_create(&batch->workers[w].thread, NULL, batch_worker, &batch->workers[w]);
+    }
+    for (u32 w = 0; w < batch->worker_count; w++) {
+        pthread_join(batch->workers[w].thread, NULL);
+        pthread_mutex_destroy(&batch->workers[w].lock);
+        free(batch->workers[w].queue);
+    }
+}
+
+static void batch_add(Batch *batch, u32 *capacity, const char *path)
+{
+    if (batch->job_count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        batch->jobs = realloc(batch->jobs, *capacity * sizeof(Batch_Job));
+        assert(batch->jobs);
+    }
+    batch->jobs[batch->job_count++] = (Batch_Job){.path = path};
+}
+
+// Arguments with wildcards are expanded here, so quoted globs work too
+static void batch_add_arg(Batch *batch, u32 *capacity, const char *arg)
+{
+    if (strpbrk(arg, "*?[") == NULL) {
+        batch_add(batch, capacity, arg);
+        return;
+    }
+    glob_t g;
+    if (glob(arg, 0, NULL, &g) != 0) {
+        fprintf(stderr, "No ROM matches %s\n", arg);
+        return;
+    }
+    for (size_t i = 0; i < g.gl_pathc; i++) batch_add(batch, capacity, strdup(g.gl_pathv[i]));
+    globfree(&g);
+}
+
+// One path per line, blank lines and lines starting with '#' are skipped
+static void batch_add_list(Batch *batch, u32 *capacity, const char *list_path)
+{
+    FILE *f = fopen(list_path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s\n", list_path);
+        exit(1);
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        batch_add_arg(batch, capacity, strdup(line));
+    }
+    fclose(f);
+}
+
+// "0-3,8,10-11". Returns the number of CPUs, 0 if the list is invalid.
+static u32 parse_cpu_list(const char *list, int *cpus, u32 max_cpus)
+{
+    u32 count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) return 0;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return 0;
+        }
+        for (long cpu = first; cpu <= last && count < max_cpus; cpu++) cpus[count++] = (int)cpu;
+        if (*end == ',') end++;
+        else if (*end != '\0') return 0;
+        p = end;
+    }
+    return count;
+}
+
+// The CPUs the process is allowed to run on
+static u32 allowed_cpus(int *cpus, u32 max_cpus)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+    u32 count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &set)) cpus[count++] = cpu;
+    }
+    return count;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+        "Usage: %s [--jobs N] [--pin] [--cpus <list>] [--timeout <emulated seconds>] [--out <file.tsv>] [--list <file>] <ROM|glob>...\n",
+        program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Batch batch = {0};
+    u32 capacity = 0;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    batch.worker_count = cores > 0 ? (u32)cores : 1;
+    f64 timeout = 60.0;
+    const char *out_path = "gb_batch.tsv";
+
+    bool jobs_given = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            batch.worker_count = atoi(argv[++i]);
+            jobs_given = true;
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            batch.pin = true;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            batch.cpu_count = parse_cpu_list(argv[++i], batch.cpus, BATCH_MAX_WORKERS);
+            if (batch.cpu_count == 0) {
+                fprintf(stderr, "Invalid CPU list: %s\n", argv[i]);
+                return 1;
+            }
+            batch.pin = true;
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0 && i + 1 < argc) {
+            batch_add_list(&batch, &capacity, argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            batch_add_arg(&batch, &capacity, argv[i]);
+        }
+    }
+    if (batch.job_count == 0 || timeout <= 0.0) usage(argv[0]);
+    if (batch.pin && batch.cpu_count == 0) batch.cpu_count = allowed_cpus(batch.cpus, BATCH_MAX_WORKERS);
+    if (batch.pin && batch.cpu_count == 0) batch.pin = false;
+    if (batch.pin && !jobs_given) batch.worker_count = batch.cpu_count; // One worker per CPU
+    if (batch.worker_count < 1) batch.worker_count = 1;
+    if (batch.worker_count > BATCH_MAX_WORKERS) batch.worker_count = BATCH_MAX_WORKERS;
+    if (batch.worker_count > batch.job_count) batch.worker_count = batch.job_count;
+    batch.timeout_cycles = (u64)(timeout * CPU_FREQ);
+
+    f64 start = batch_now();
+    batch_run(&batch);
+    f64 elapsed = batch_now() - start;
+
+    u32 passed = 0;
+    printf("%-48s %-10s %10s %8s\n", "ROM", "Result", "Emulated", "Host");
+    for (u32 i = 0; i < batch.job_count; i++) {
+        Batch_Job *job = &batch.jobs[i];
+        const char *name = strrchr(job->path, '/') ? strrchr(job->path, '/') + 1 : job->path;
+        printf("%-48.48s %-10s %9.2fs %7.3fs\n", name, BATCH_RESULT_STR[job->result],
+            (f64)job->cycles / CPU_FREQ, job->seconds);
+        if (job->result == BR_PASSED) passed += 1;
+    }
+    printf("%u/%u passed in %.2fs (%u threads)\n", passed, batch.job_count, elapsed, batch.worker_count);
+
+    // Speed is emulated time over busy host time, 1.0x being real time
+    printf("\n%-6s %4s %5s %10s %8s %9s\n", "Worker", "CPU", "Jobs", "Emulated", "Busy", "Speed");
+    u64 total_cycles = 0;
+    for (u32 w = 0; w < batch.worker_count; w++) {
+        Batch_Worker *worker = &batch.workers[w];
+        f64 emulated = (f64)worker->cycles / CPU_FREQ;
+        char cpu[16] = "-";
+        if (worker->cpu >= 0) snprintf(cpu, sizeof(cpu), "%d", worker->cpu);
+        printf("%-6u %4s %5u %9.2fs %7.3fs %8.1fx\n", w, cpu, worker->jobs_run, emulated, worker->busy,
+            worker->busy > 0.0 ? emulated / worker->busy : 0.0);
+        total_cycles += worker->cycles;
+    }
+    printf("Total: %.1fx real time\n", elapsed > 0.0 ? (f64)total_cycles / CPU_FREQ / elapsed : 0.0);
+
+    FILE *out = fopen(out_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s\n", out_path);
+        return 1;
+    }
+    fprintf(out, "rom\tresult\tcycles\tseconds\tworker\n");
+    for (u32 i = 0; i < batch.job_count; i++) {
+        Batch_Job *job = &batch.jobs[i];
+        fprintf(out, "%s\t%s\t%llu\t%.6f\t%u\n", job->path, BATCH_RESULT_STR[job->result],
+            (unsigned long long)job->cycles, job->seconds, job->worker);
+    }
+    fclose(out);
+
+    return passed == batch.job_count ? 0 : 1;
+}
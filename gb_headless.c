@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "gb.h"
 
@@ -25,9 +28,22 @@ typedef struct Command {
     size_t addr;
 } Command;
 
-#define MAX_BREAKPOINTS 16
-static u16 breakpoints[MAX_BREAKPOINTS];
-static size_t bp_count;
+// Audio capture (--audio): the mixed APU output as 16-bit stereo PCM, in a WAV
+// file or raw. Samples are written in large blocks and hashed (FNV-1a) so that
+// CI can compare runs.
+#define CAPTURE_FRAMES (64*1024) // Stereo frames per write
+
+typedef struct Capture {
+    FILE *file;
+    bool wav;
+    u32 rate;
+    s16 block[2*CAPTURE_FRAMES];
+    size_t count;  // Frames in block
+    u64 frames;    // Frames written
+    u64 hash;
+} Capture;
+
+static Capture capture;
 
 static char* trim_cstr(char *s)
 {
@@ -148,20 +164,390 @@ void cmd_examine(GameBoy *gb, Command cmd)
 
 void cmd_break(GameBoy *gb, Command cmd)
 {
-    (void)gb;
     assert(cmd.type == CT_BREAK);
-    assert(bp_count < MAX_BREAKPOINTS);
-    breakpoints[bp_count++] = cmd.addr;
+    assert(gb->breakpoint_count < GB_MAX_BREAKPOINTS);
+    gb->breakpoints[gb->breakpoint_count++] = cmd.addr;
     printf("Setting breakpoint at $%04x\n", (u16)cmd.addr);
 }
 
+static void capture_write_wav_header(Capture *c)
+{
+    u32 data_size = (u32)(c->frames * 2 * sizeof(s16));
+    u8 header[44];
+    u32 fields[] = {
+        0x46464952, 36 + data_size, 0x45564157,        // "RIFF", size, "WAVE"
+        0x20746d66, 16, 0x00020001, c->rate,           // "fmt ", PCM, 2 channels
+        c->rate * 2 * sizeof(s16), 0x00100004,         // Byte rate, align 4, 16 bits
+        0x61746164, data_size,                         // "data"
+    };
+    for (size_t i = 0; i < 11; i++) {
+        for (size_t b = 0; b < 4; b++) header[4*i + b] = (fields[i] >> (8*b)) & 0xFF;
+    }
+    fseek(c->file, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, c->file);
+    fseek(c->file, 0, SEEK_END);
+}
+
+static void capture_open(Capture *c, const char *path, u32 rate)
+{
+    c->rate = rate;
+    c->file = fopen(path, "wb");
+    if (!c->file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(1);
+    }
+    size_t len = strlen(path);
+    c->wav = len > 4 && strcasecmp(path + len - 4, ".wav") == 0;
+    c->hash = 0xCBF29CE484222325ull;
+    if (c->wav) capture_write_wav_header(c);
+}
+
+static void capture_flush(Capture *c)
+{
+    const u8 *bytes = (const u8 *)c->block;
+    size_t size = c->count * 2 * sizeof(s16);
+    for (size_t i = 0; i < size; i++) {
+        c->hash = (c->hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    fwrite(c->block, size, 1, c->file);
+    c->frames += c->count;
+    c->count = 0;
+}
+
+static void capture_samples(Capture *c, const f32 *samples, size_t frames)
+{
+    for (size_t i = 0; i < 2*frames; i++) {
+        f32 x = samples[i] * 32767.0f;
+        if (x > 32767.0f) x = 32767.0f;
+        if (x < -32768.0f) x = -32768.0f;
+        c->block[2*c->count + (i & 1)] = (s16)x;
+        if (i & 1) c->count += 1;
+        if (c->count == CAPTURE_FRAMES) capture_flush(c);
+    }
+}
+
+// Also runs when a test ROM ends the process
+static void capture_close(void)
+{
+    Capture *c = &capture;
+    if (!c->file) return;
+    capture_flush(c);
+    if (c->wav) capture_write_wav_header(c);
+    fclose(c->file);
+    c->file = NULL;
+    printf("Audio: %llu frames, hash %016llx\n",
+        (unsigned long long)c->frames, (unsigned long long)c->hash);
+}
+
+// Branching (--fork): the warmed-up instance is forked once per input script.
+// Children share the parent's pages copy-on-write and nothing is rendered or
+// synthesized, so a branch only copies the pages it writes (mostly WRAM, HRAM
+// and the registers). Each child sends one Branch_Result through a pipe shared
+// by all; results are smaller than PIPE_BUF, so they never interleave.
+#define BRANCH_MAX_STEPS 256
+
+typedef struct Branch_Step {
+    u32 frames;
+    u8 buttons; // GB_BUTTON_*
+} Branch_Step;
+
+typedef struct Branch_Script {
+    Branch_Step *steps;
+    size_t step_count;
+} Branch_Script;
+
+typedef struct Branch_Result {
+    u32 index;
+    GB_Status status;
+    u16 pc;
+    u64 frames;
+    u64 ram_hash;       // FNV-1a of WRAM and HRAM
+    long page_faults;   // Minor faults while running, i.e. pages copied on write
+} Branch_Result;
+
+static const char *BUTTON_NAMES[8] = {"A", "B", "SELECT", "START", "RIGHT", "LEFT", "UP", "DOWN"};
+
+// Steps are "<frames>:<buttons>" separated by spaces. Buttons are joined with
+// '+', '-' holds none. E.g. "120:- 5:START 30:RIGHT+A"
+// Returns false (after logging why) on an invalid step or button.
+static bool branch_parse_script(char *line, Branch_Step *steps, size_t max_steps, size_t *step_count)
+{
+    size_t count = 0;
+    for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        char *name = strchr(tok, ':');
+        if (name == NULL || count == max_steps) {
+            fprintf(stderr, "Invalid script step: %s\n", tok);
+            return false;
+        }
+        *name++ = '\0';
+        Branch_Step step = {.frames = (u32)atoi(tok)};
+        while (strcmp(name, "-") != 0) {
+            char *plus = strchr(name, '+');
+            if (plus) *plus = '\0';
+            int b = 0;
+            while (b < 8 && strcasecmp(name, BUTTON_NAMES[b]) != 0) b++;
+            if (b == 8) {
+                fprintf(stderr, "Invalid button: %s\n", name);
+                return false;
+            }
+            step.buttons |= 1 << b;
+            if (plus == NULL) break;
+            name = plus + 1;
+        }
+        steps[count++] = step;
+    }
+    *step_count = count;
+    return true;
+}
+
+static u64 branch_ram_hash(const GameBoy *gb)
+{
+    u64 hash = 0xCBF29CE484222325ull;
+    for (u32 addr = 0xC000; addr < 0x10000; addr++) {
+        if (addr == 0xE000) addr = 0xFF80; // Skip echo RAM, OAM and I/O
+        hash = (hash ^ gb->memory[addr]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Runs in the child
+static void branch_run(GameBoy *gb, u32 index, const Branch_Step *steps, size_t step_count, int fd)
+{
+    struct rusage start, end;
+    getrusage(RUSAGE_SELF, &start);
+
+    u64 frames = 0;
+    for (size_t i = 0; i < step_count && gb->status == GB_STATUS_OK; i++) {
+        gb_set_buttons(gb, steps[i].buttons);
+        for (u32 f = 0; f < steps[i].frames && gb->status == GB_STATUS_OK; f++) {
+            gb_run_frame(gb);
+            frames++;
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &end);
+    Branch_Result result = {
+        .index = index,
+        .status = gb->status,
+        .pc = gb->PC,
+        .frames = frames,
+        .ram_hash = branch_ram_hash(gb),
+        .page_faults = end.ru_minflt - start.ru_minflt,
+    };
+    if (write(fd, &result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+// Reaps one child. A child that exited normally has its result in the pipe.
+static void branch_reap(int fd, Branch_Result *results, bool *received)
+{
+    int wstatus;
+    if (waitpid(-1, &wstatus, 0) < 0) return;
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) return;
+
+    Branch_Result result;
+    if (read(fd, &result, sizeof(result)) == sizeof(result)) {
+        results[result.index] = result;
+        received[result.index] = true;
+    }
+}
+
+// Parses every non-empty line of scripts_path. Returns NULL (after logging
+// why) if any line is invalid, so that nothing is forked for a bad file.
+static Branch_Script *branch_load_scripts(const char *scripts_path, u32 *count)
+{
+    FILE *f = fopen(scripts_path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s\n", scripts_path);
+        return NULL;
+    }
+    u32 capacity = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) capacity++;
+    rewind(f);
+
+    Branch_Script *scripts = calloc(capacity ? capacity : 1, sizeof(Branch_Script));
+    assert(scripts);
+    *count = 0;
+    u32 line_num = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        static Branch_Step steps[BRANCH_MAX_STEPS];
+        size_t step_count;
+        line_num++;
+        ok = branch_parse_script(line, steps, BRANCH_MAX_STEPS, &step_count);
+        if (!ok) {
+            fprintf(stderr, "%s:%u: invalid script\n", scripts_path, line_num);
+        } else if (step_count > 0) {
+            Branch_Script *script = &scripts[(*count)++];
+            script->steps = malloc(step_count * sizeof(Branch_Step));
+            assert(script->steps);
+            memcpy(script->steps, steps, step_count * sizeof(Branch_Step));
+            script->step_count = step_count;
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        for (u32 i = 0; i < *count; i++) free(scripts[i].steps);
+        free(scripts);
+        return NULL;
+    }
+    return scripts;
+}
+
+// One branch per non-empty line of scripts_path, at most one child per core
+static int branch_all(GameBoy *gb, const char *scripts_path)
+{
+    u32 count;
+    Branch_Script *scripts = branch_load_scripts(scripts_path, &count);
+    if (scripts == NULL) return 1;
+
+    Branch_Result *results = calloc(count ? count : 1, sizeof(Branch_Result));
+    bool *received = calloc(count ? count : 1, sizeof(bool));
+    assert(results && received);
+    int fds[2];
+    if (pipe(fds) < 0) {
+        fprintf(stderr, "Failed to create a pipe\n");
+        return 1;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_children = cores > 0 ? (u32)cores : 1;
+    fflush(stdout); // Children must not flush the parent's output again
+
+    u32 index = 0;
+    u32 running = 0;
+    for (; index < count; index++) {
+        if (running == max_children) {
+            branch_reap(fds[0], results, received);
+            running--;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Failed to fork\n");
+            break;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            branch_run(gb, index, scripts[index].steps, scripts[index].step_count, fds[1]);
+            _exit(0);
+        }
+        running++;
+    }
+    close(fds[1]);
+    for (; running > 0; running--) branch_reap(fds[0], results, received);
+    close(fds[0]);
+
+    u32 failed = 0;
+    printf("Branch  Frames  Status      PC     RAM hash          Pages copied\n");
+    for (u32 i = 0; i < index; i++) {
+        if (!received[i]) {
+            printf("%6u  %6s  %s\n", i, "-", "CRASHED");
+            failed++;
+            continue;
+        }
+        Branch_Result *r = &results[i];
+        printf("%6u  %6llu  %-10s  $%04x  %016llx  %ld\n", i, (unsigned long long)r->frames,
+            gb_status_str(r->status), r->pc, (unsigned long long)r->ram_hash, r->page_faults);
+    }
+    for (u32 i = 0; i < count; i++) free(scripts[i].steps);
+    free(scripts);
+    free(results);
+    free(received);
+    return failed == 0 ? 0 : 1;
+}
+
+// Link cable (--link): a second ROM connected over serial, both run uncapped
+// and interleaved on this thread for --seconds of emulated time (default 60).
+static int link_run(GameBoy *gb, const char *path, f64 seconds)
+{
+    GameBoy *peer = calloc(1, sizeof(*peer));
+    if (peer == NULL || gb_load_rom_file(peer, path) != GB_STATUS_OK) {
+        fprintf(stderr, "Failed to load linked ROM %s\n", path);
+        return 1;
+    }
+    gb->printf = NULL; // Test ROM logs would interleave
+    gb_init(gb);
+    gb_init(peer);
+    gb_set_render_policy(peer, RP_ON_REQUEST, 0);
+
+    GB_Link link;
+    gb_link_connect(&link, gb, peer, 0);
+    u64 end_cycles = (u64)((seconds > 0.0 ? seconds : 60.0) * CPU_FREQ);
+    while (link.cycles[0] < end_cycles && gb->status == GB_STATUS_OK && peer->status == GB_STATUS_OK) {
+        gb_link_run(&link, DOTS_PER_FRAME);
+    }
+    gb_link_disconnect(&link);
+
+    printf("Side  %-10s  %-5s  %-16s\n", "Status", "PC", "RAM hash");
+    GameBoy *sides[2] = {gb, peer};
+    for (int i = 0; i < 2; i++) {
+        printf("%4d  %-10s  $%04x  %016llx\n", i, gb_status_str(sides[i]->status), sides[i]->PC,
+            (unsigned long long)branch_ram_hash(sides[i]));
+    }
+    int failed = gb->status > GB_STATUS_PASSED || peer->status > GB_STATUS_PASSED;
+    free(peer->rom);
+    free(peer);
+    return failed;
+}
+
 int main(int argc, char **argv)
 {
+    // Options come before the ROM path. Anything else starts the debugger.
+    const char *audio_path = NULL;
+    u32 audio_rate = 48000;
+    f64 seconds = 0.0;
+    const char *fork_path = NULL;
+    f64 warmup = 0.0;
+    const char *link_path = NULL;
+    bool single_stepping = false;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc - 1) {
+            audio_path = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc - 1) {
+            audio_rate = atoi(argv[++i]);
+            if (audio_rate < 8000 || audio_rate > 96000) {
+                fprintf(stderr, "Invalid sample rate: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc - 1) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--fork") == 0 && i + 1 < argc - 1) {
+            fork_path = argv[++i];
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc - 1) {
+            warmup = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc - 1) {
+            link_path = argv[++i];
+        } else {
+            single_stepping = true;
+        }
+    }
+
     GameBoy gb = {0};
-    gb_init_with_args(&gb, argc, argv);
+    if (gb_init_with_args(&gb, argc, argv) != GB_STATUS_OK) return 1;
+    gb_set_render_policy(&gb, RP_ON_REQUEST, 0); // No pixels needed
+
+    if (link_path) return link_run(&gb, link_path, seconds);
+
+    // Branching: run uncapped up to the snapshot point, then fork
+    if (fork_path) {
+        gb.printf = NULL; // Keep the serial log of every branch quiet
+        gb_init(&gb);
+        u64 warmup_cycles = (u64)(warmup * CPU_FREQ);
+        while (gb.status == GB_STATUS_OK && gb.elapsed_cycles < warmup_cycles) gb_run_frame(&gb);
+        printf("Snapshot at $%04x after %.2fs, RAM hash %016llx\n", gb.PC,
+            (f64)gb.elapsed_cycles / CPU_FREQ, (unsigned long long)branch_ram_hash(&gb));
+        return branch_all(&gb, fork_path);
+    }
+
+    // Capturing runs uncapped, one frame at a time, for --seconds of emulated time
+    if (audio_path) {
+        capture_open(&capture, audio_path, audio_rate);
+        atexit(capture_close);
+        gb_init(&gb);
+        gb_apu_set_sample_rate(&gb, audio_rate);
+    }
+    u64 end_cycles = seconds > 0.0 ? (u64)(seconds * CPU_FREQ) : UINT64_MAX;
 
     bool running = true;
-    bool single_stepping = argc != 2;
     while (running) {
         if (single_stepping) {
             Command cmd = read_command();
@@ -181,8 +567,8 @@ int main(int argc, char **argv)
                 default: printf("Unhandled command\n");
             }
         } else {
-            for (size_t i = 0; i < bp_count; i++) {
-                if (breakpoints[i] == gb.PC) {
+            for (size_t i = 0; i < gb.breakpoint_count; i++) {
+                if (gb.breakpoints[i] == gb.PC) {
                     printf("Hit breakpoint at $%04x\n", gb.PC);
                     single_stepping = true;
                     break;
@@ -193,11 +579,23 @@ int main(int argc, char **argv)
             //Inst inst = gb_fetch(&gb);
             //gb_exec(&gb, inst);
             //printf("$%04x (gb_headless)\n", gb.PC);
-            gb_update(&gb);
+            if (audio_path) {
+                static f32 samples[2*BLIP_SIZE];
+                gb_run_frame(&gb);
+                size_t frames = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+                capture_samples(&capture, samples, frames);
+            } else {
+                gb_update(&gb);
+            }
+            if (gb.elapsed_cycles >= end_cycles) running = false;
         }
+        if (gb.status != GB_STATUS_OK) running = false;
     }
 
-    return 0;
+    if (gb.status == GB_STATUS_ILLEGAL_OP) {
+        fprintf(stderr, "Illegal instruction $%02X at $%04x\n", gb.memory[gb.PC], gb.PC);
+    }
+    return gb.status == GB_STATUS_OK || gb.status == GB_STATUS_PASSED ? 0 : 1;
 }
 
 static u64 t_cycles;
@@ -324,6 +722,6 @@ void gb_tick_m(GameBoy *gb)
     }
 
     // Fetch
-    fetch_inst = gb_fetch_internal(gb->memory + fetch_addr, gb->F, false);
+    fetch_inst = gb_fetch_internal(gb->memory + fetch_addr, gb->F);
     fetch_addr += fetch_inst.size;
 }
@@ -8,7 +8,6 @@
 #include "gb.h"
 
 #define SCALE  8
-#define SAMPLE_RATE 48000
 #define VOLUME 0.25
 
 // RRGGBBAA
@@ -37,207 +36,311 @@ typedef enum ViewerType {
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_AudioDeviceID device;
-static ViewerType viewer_type = VT_GAME;
+static int audio_rate = 48000; // Sample rate requested from the device (--rate)
+static int audio_freq;         // Sample rate obtained from the device
+
+// The emulation pushes the samples of each frame into audio_ring, the device
+// callback pulls them. audio_latency is the device buffer size (--latency).
+static Audio_Ring audio_ring;
+static u32 audio_latency = 256;
+static u32 audio_target;   // Ring level aimed for right before a frame is pushed
+static f64 audio_fill_avg; // Smoothed ring level
+
+static bool vsync; // Present waits for vsync (--vsync)
+static _Atomic ViewerType viewer_type = VT_GAME;
 
 static bool show_menu;
+static bool force_present; // Present even if no new frame arrived
+
+// Fast-forward runs several emulated frames per presented frame (Tab toggles it)
+#define SPEED_UNLIMITED 0
+static atomic_bool fast_forward;
+static u32 fast_forward_speed = 4; // Emulated frames per presented frame, or SPEED_UNLIMITED
+
+// The emulation runs on its own thread, paced by the frame timer. The main
+// thread polls events and presents (SDL wants both there), so a slow present
+// or a window drag never stalls the emulation. Finished frames go through a
+// triple buffer; input and commands go the other way through atomics.
+static Frame_Buffer frame_buffer;
+static atomic_bool emu_running;
+static atomic_bool emu_paused;
+static _Atomic u8 emu_buttons;       // GB_BUTTON_* held down
+static atomic_bool dump_requested;   // Print the state (Space)
+static _Atomic u32 emulated_frames;  // Since the title was last updated
+
+static u64 presented_frames;
+static u64 duplicated_frames; // Presented again because no new frame had arrived
+
+// Debug viewers draw from a copy of the state. The emulation thread refreshes
+// it after each frame unless the main thread holds the lock.
+static SDL_mutex *debug_lock;
+static GameBoy debug_gb;
+static u32 debug_gen;       // Copies made
+static u32 debug_gen_drawn; // Copy last drawn
+
+// Frames are uploaded to textures and drawn with a single scaled copy.
+// Debug viewers keep the hash of the data they were built from and are only
+// rebuilt when it changes.
+typedef struct Debug_Texture {
+    SDL_Texture *texture;
+    int w, h;
+    u64 hash;
+} Debug_Texture;
+
+static SDL_Texture *game_texture;
+static Debug_Texture tiles_texture;
+static Debug_Texture tilemap_texture;
+static Debug_Texture regs_texture;
 
-static void render_debug_tile(SDL_Renderer *renderer, u8 *tile, int x, int y, int w, int h)
+#define FNV1A_INIT 0xCBF29CE484222325ull
+
+static u64 fnv1a(u64 hash, const void *data, size_t size)
 {
-    // 8x8 pixels
-    for (int row = 0; row < 8; row++) {
-        u8 low_bitplane  = tile[row*2+0];
-        u8 high_bitplane = tile[row*2+1];
-        for (int col = 0; col < 8; col++) {
-            u8 bit0 = (low_bitplane & 0x80) >> 7;
-            u8 bit1 = (high_bitplane & 0x80) >> 7;
-            low_bitplane <<= 1;
-            high_bitplane <<= 1;
-
-            u8 color_idx = (bit1 << 1) | bit0;
-            Color color = PALETTE[color_idx];
-            SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(color));
-
-            int xpixel = x+col*(w/8);
-            int ypixel = y+row*(h/8);
-            SDL_Rect r = { xpixel, ypixel, w/8, h/8};
-            SDL_RenderFillRect(renderer, &r);
-        }
+    const u8 *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
     }
+    return hash;
 }
 
-static void render_debug_tiles_section(SDL_Renderer *renderer, u8 *tiles, int x, int y, int w, int h)
+// (Re)creates the texture if its size or access changed. Returns true if its
+// contents must be rebuilt.
+static bool debug_texture_prepare(Debug_Texture *dt, int access, int w, int h, u64 hash)
 {
-    // 16x8 tiles
-    SDL_Rect r = { x, y, w, h};
-    SDL_RenderFillRect(renderer, &r);
+    if (dt->texture && dt->w == w && dt->h == h) {
+        if (dt->hash == hash) return false;
+    } else {
+        if (dt->texture) SDL_DestroyTexture(dt->texture);
+        dt->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, access, w, h);
+        if (!dt->texture) {
+            fprintf(stderr, "Failed to create texture: %s\n", SDL_GetError());
+            exit(1);
+        }
+        dt->w = w;
+        dt->h = h;
+    }
+    dt->hash = hash;
+    return true;
+}
 
-    f32 w_tile = w/16.0f;
-    f32 h_tile = h/8.0f;
-    int tile_dim = (w_tile > h_tile) ? h_tile : w_tile;
-
-    int xstart = (w - tile_dim*16)/2;
-    int ystart = (h - tile_dim*8)/2;
-    x += xstart;
-    y += ystart;
-
-    for (int row = 0; row < 8; row++) {
-        for (int col = 0; col < 16; col++) {
-            SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(MAGENTA));
-            int xtile = x+col*tile_dim;
-            int ytile = y+row*tile_dim;
-            SDL_Rect r = { xtile, ytile, tile_dim, tile_dim};
-            SDL_RenderFillRect(renderer, &r);
+// Largest integer scale of a (src_w x src_h) image that fits in (w x h), at least 1
+static int integer_scale(int w, int h, int src_w, int src_h)
+{
+    int sx = w / src_w;
+    int sy = h / src_h;
+    int scale = sx < sy ? sx : sy;
+    return scale > 0 ? scale : 1;
+}
 
-            int tile_idx = row*16 + col; // 0-127
-            u8 *tile = tiles + tile_idx*16;
-            render_debug_tile(renderer, tile, xtile, ytile, tile_dim, tile_dim);
+// ASCII printable characters 32-127 (' ' .. '~'), 2bpp 8x8 tiles
+#define FONT_GLYPHS 96
+static const u8 FONT_TILES[FONT_GLYPHS*16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00,
+    0x6C, 0x6C, 0x6C, 0x6C, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x6C, 0x6C, 0xFE, 0xFE, 0x6C, 0x6C, 0x6C, 0x6C, 0xFE, 0xFE, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00,
+    0x18, 0x18, 0x3E, 0x3E, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x7C, 0x7C, 0x18, 0x18, 0x00, 0x00,
+    0x66, 0x66, 0x6C, 0x6C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0xC6, 0xC6, 0x86, 0x86, 0x00, 0x00,
+    0x1C, 0x1C, 0x36, 0x36, 0x1C, 0x1C, 0x38, 0x38, 0x6F, 0x6F, 0x66, 0x66, 0x3B, 0x3B, 0x00, 0x00,
+    0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x0E, 0x0E, 0x1C, 0x1C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1C, 0x1C, 0x0E, 0x0E, 0x00, 0x00,
+    0x70, 0x70, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x38, 0x70, 0x70, 0x00, 0x00,
+    0x00, 0x00, 0x66, 0x66, 0x3C, 0x3C, 0xFF, 0xFF, 0x3C, 0x3C, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x30, 0x30, 0x60, 0x60,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    0x02, 0x02, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x40, 0x40, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x6E, 0x6E, 0x76, 0x76, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x18, 0x18, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x7E, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x7E, 0x7E, 0x00, 0x00,
+    0x7E, 0x7E, 0x0C, 0x0C, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x0C, 0x0C, 0x1C, 0x1C, 0x3C, 0x3C, 0x6C, 0x6C, 0x7E, 0x7E, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00,
+    0x7E, 0x7E, 0x60, 0x60, 0x7C, 0x7C, 0x06, 0x06, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x3C, 0x3C, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x7E, 0x7E, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x0C, 0x0C, 0x38, 0x38, 0x00, 0x00,
+    0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x30, 0x30, 0x00, 0x00,
+    0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00,
+    0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x6E, 0x6E, 0x6A, 0x6A, 0x6E, 0x6E, 0x60, 0x60, 0x3E, 0x3E, 0x00, 0x00,
+    0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x7E, 0x7E, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x00, 0x00,
+    0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+    0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    0x3E, 0x3E, 0x60, 0x60, 0x60, 0x60, 0x6E, 0x6E, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7E, 0x7E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x3C, 0x3C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x70, 0x70, 0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
+    0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+    0xC6, 0xC6, 0xEE, 0xEE, 0xFE, 0xFE, 0xD6, 0xD6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0x00, 0x00,
+    0x66, 0x66, 0x76, 0x76, 0x7E, 0x7E, 0x7E, 0x7E, 0x6E, 0x6E, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x76, 0x76, 0x6C, 0x6C, 0x36, 0x36, 0x00, 0x00,
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x6C, 0x6C, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x00,
+    0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xD6, 0xD6, 0xFE, 0xFE, 0xEE, 0xEE, 0xC6, 0xC6, 0x00, 0x00,
+    0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
+    0x7E, 0x7E, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+    0x1E, 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x1E, 0x00, 0x00,
+    0x40, 0x40, 0x60, 0x60, 0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x02, 0x02, 0x00, 0x00,
+    0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x78, 0x78, 0x00, 0x00,
+    0x10, 0x10, 0x38, 0x38, 0x6C, 0x6C, 0xC6, 0xC6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE,
+    0xC0, 0xC0, 0x60, 0x60, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x06, 0x06, 0x3E, 0x3E, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x3C, 0x3C, 0x00, 0x00,
+    0x06, 0x06, 0x06, 0x06, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x66, 0x66, 0x7E, 0x7E, 0x60, 0x60, 0x3C, 0x3C, 0x00, 0x00,
+    0x1C, 0x1C, 0x30, 0x30, 0x7C, 0x7C, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x7C, 0x7C,
+    0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x18, 0x18, 0x00, 0x00, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
+    0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x70, 0x70,
+    0x60, 0x60, 0x60, 0x60, 0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
+    0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xEC, 0xEC, 0xFE, 0xFE, 0xD6, 0xD6, 0xC6, 0xC6, 0xC6, 0xC6, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x60, 0x60,
+    0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06,
+    0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x7C, 0x7C, 0x00, 0x00,
+    0x00, 0x00, 0x18, 0x18, 0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x0E, 0x0E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xC6, 0xC6, 0xC6, 0xC6, 0xD6, 0xD6, 0x7C, 0x7C, 0x6C, 0x6C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x7C, 0x7C,
+    0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x7E, 0x7E, 0x00, 0x00,
+    0x0E, 0x0E, 0x18, 0x18, 0x18, 0x18, 0x30, 0x30, 0x18, 0x18, 0x18, 0x18, 0x0E, 0x0E, 0x00, 0x00,
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
+    0x70, 0x70, 0x18, 0x18, 0x18, 0x18, 0x0C, 0x0C, 0x18, 0x18, 0x18, 0x18, 0x70, 0x70, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0xF2, 0xF2, 0x9E, 0x9E, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static SDL_Texture *font_texture; // All the glyphs side by side, built once
+
+static void font_init(void)
+{
+    static Color pixels[FONT_GLYPHS*8*8];
+    for (int glyph = 0; glyph < FONT_GLYPHS; glyph++) {
+        const u8 *tile = FONT_TILES + glyph*16;
+        for (int row = 0; row < 8; row++) {
+            // Glyphs are drawn inverted: light on dark
+            u8 low_bitplane  = ~tile[row*2+0];
+            u8 high_bitplane = ~tile[row*2+1];
+            for (int col = 0; col < 8; col++) {
+                u8 bit0 = (low_bitplane >> (7 - col)) & 1;
+                u8 bit1 = (high_bitplane >> (7 - col)) & 1;
+                pixels[row*FONT_GLYPHS*8 + glyph*8 + col] = PALETTE[(bit1 << 1) | bit0];
+            }
         }
     }
+
+    font_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_STATIC, FONT_GLYPHS*8, 8);
+    if (!font_texture) {
+        fprintf(stderr, "Failed to create texture\n");
+        exit(1);
+    }
+    SDL_UpdateTexture(font_texture, NULL, pixels, FONT_GLYPHS*8*sizeof(Color));
 }
 
+// 3 sections of 128 tiles ($8000-$87FF, $8800-$8FFF, $9000-$97FF), 16x8 tiles each
+#define DBG_TILES_W (16*TILE_PIXELS)
+#define DBG_TILES_H (3*8*TILE_PIXELS)
+
 static void render_debug_tiles(SDL_Renderer *renderer, int w, int h, u8 *tile_data)
 {
-    // 3 sections of 128 tiles (16x8 tiles)
-    // Render tiles at $8000-$87FF
-    {
-        SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
-        //u8 *tiles = gb->memory + 0x8000;
-        u8 *tiles = tile_data;
-        render_debug_tiles_section(renderer, tiles, 0, (h/3)*0, w, h/3);
+    u64 hash = fnv1a(FNV1A_INIT, tile_data, 3*128*16);
+    if (debug_texture_prepare(&tiles_texture, SDL_TEXTUREACCESS_STREAMING, DBG_TILES_W, DBG_TILES_H, hash)) {
+        static Color pixels[DBG_TILES_W*DBG_TILES_H];
+        for (int tile_idx = 0; tile_idx < 3*128; tile_idx++) {
+            const u8 *tile = tile_data + tile_idx*16;
+            int x = (tile_idx % 16)*TILE_PIXELS;
+            int y = (tile_idx / 16)*TILE_PIXELS;
+            for (int row = 0; row < 8; row++) {
+                u8 low_bitplane  = tile[row*2+0];
+                u8 high_bitplane = tile[row*2+1];
+                for (int col = 0; col < 8; col++) {
+                    u8 bit0 = (low_bitplane >> (7 - col)) & 1;
+                    u8 bit1 = (high_bitplane >> (7 - col)) & 1;
+                    pixels[(y+row)*DBG_TILES_W + x+col] = PALETTE[(bit1 << 1) | bit0];
+                }
+            }
+        }
+        SDL_UpdateTexture(tiles_texture.texture, NULL, pixels, DBG_TILES_W*sizeof(Color));
     }
 
-    // Render tiles at $8800-$8FFF
-    {
-        SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
-        //u8 *tiles = gb->memory + 0x8800;
-        u8 *tiles = tile_data + 0x800;
-        render_debug_tiles_section(renderer, tiles, 0, (h/3)*1, w, h/3);
-    }
-
-    // Render tiles at $9000-$97FF
-    {
-        SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
-        //u8 *tiles = gb->memory + 0x9000;
-        u8 *tiles = tile_data + 0x1000;
-        render_debug_tiles_section(renderer, tiles, 0, (h/3)*2, w, h/3);
+    int section_h = h/3;
+    int pixel_dim = integer_scale(w, section_h, DBG_TILES_W, DBG_TILES_H/3);
+    for (int section = 0; section < 3; section++) {
+        SDL_Rect src = {0, section*DBG_TILES_H/3, DBG_TILES_W, DBG_TILES_H/3};
+        SDL_Rect dst = {
+            (w - DBG_TILES_W*pixel_dim)/2,
+            section*section_h + (section_h - src.h*pixel_dim)/2,
+            DBG_TILES_W*pixel_dim, src.h*pixel_dim,
+        };
+        SDL_RenderCopy(renderer, tiles_texture.texture, &src, &dst);
     }
 }
 
 static void render_debug_text(SDL_Renderer *renderer, const char *text, int row, int col)
 {
-    u8 tiles[] = {
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00,
-        0x6C, 0x6C, 0x6C, 0x6C, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x6C, 0x6C, 0xFE, 0xFE, 0x6C, 0x6C, 0x6C, 0x6C, 0xFE, 0xFE, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00,
-        0x18, 0x18, 0x3E, 0x3E, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x7C, 0x7C, 0x18, 0x18, 0x00, 0x00,
-        0x66, 0x66, 0x6C, 0x6C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0xC6, 0xC6, 0x86, 0x86, 0x00, 0x00,
-        0x1C, 0x1C, 0x36, 0x36, 0x1C, 0x1C, 0x38, 0x38, 0x6F, 0x6F, 0x66, 0x66, 0x3B, 0x3B, 0x00, 0x00,
-        0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x0E, 0x0E, 0x1C, 0x1C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1C, 0x1C, 0x0E, 0x0E, 0x00, 0x00,
-        0x70, 0x70, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x38, 0x38, 0x70, 0x70, 0x00, 0x00,
-        0x00, 0x00, 0x66, 0x66, 0x3C, 0x3C, 0xFF, 0xFF, 0x3C, 0x3C, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x30, 0x30, 0x60, 0x60,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
-        0x02, 0x02, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x40, 0x40, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x6E, 0x6E, 0x76, 0x76, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x18, 0x18, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x7E, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x7E, 0x7E, 0x00, 0x00,
-        0x7E, 0x7E, 0x0C, 0x0C, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x0C, 0x0C, 0x1C, 0x1C, 0x3C, 0x3C, 0x6C, 0x6C, 0x7E, 0x7E, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00,
-        0x7E, 0x7E, 0x60, 0x60, 0x7C, 0x7C, 0x06, 0x06, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x3C, 0x3C, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x7E, 0x7E, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x0C, 0x0C, 0x38, 0x38, 0x00, 0x00,
-        0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x30, 0x30, 0x00, 0x00,
-        0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x00, 0x00, 0x00, 0x00,
-        0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x6E, 0x6E, 0x6A, 0x6A, 0x6E, 0x6E, 0x60, 0x60, 0x3E, 0x3E, 0x00, 0x00,
-        0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x7E, 0x7E, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x00, 0x00,
-        0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
-        0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
-        0x3E, 0x3E, 0x60, 0x60, 0x60, 0x60, 0x6E, 0x6E, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
-        0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7E, 0x7E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x3C, 0x3C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
-        0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x70, 0x70, 0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
-        0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
-        0xC6, 0xC6, 0xEE, 0xEE, 0xFE, 0xFE, 0xD6, 0xD6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0x00, 0x00,
-        0x66, 0x66, 0x76, 0x76, 0x7E, 0x7E, 0x7E, 0x7E, 0x6E, 0x6E, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x76, 0x76, 0x6C, 0x6C, 0x36, 0x36, 0x00, 0x00,
-        0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x6C, 0x6C, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
-        0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
-        0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x00,
-        0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xD6, 0xD6, 0xFE, 0xFE, 0xEE, 0xEE, 0xC6, 0xC6, 0x00, 0x00,
-        0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
-        0x7E, 0x7E, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
-        0x1E, 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x1E, 0x00, 0x00,
-        0x40, 0x40, 0x60, 0x60, 0x30, 0x30, 0x18, 0x18, 0x0C, 0x0C, 0x06, 0x06, 0x02, 0x02, 0x00, 0x00,
-        0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x78, 0x78, 0x00, 0x00,
-        0x10, 0x10, 0x38, 0x38, 0x6C, 0x6C, 0xC6, 0xC6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE,
-        0xC0, 0xC0, 0x60, 0x60, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x06, 0x06, 0x3E, 0x3E, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
-        0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x3C, 0x3C, 0x00, 0x00,
-        0x06, 0x06, 0x06, 0x06, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x66, 0x66, 0x7E, 0x7E, 0x60, 0x60, 0x3C, 0x3C, 0x00, 0x00,
-        0x1C, 0x1C, 0x30, 0x30, 0x7C, 0x7C, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x7C, 0x7C,
-        0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x18, 0x18, 0x00, 0x00, 0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
-        0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x70, 0x70,
-        0x60, 0x60, 0x60, 0x60, 0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
-        0x38, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, 0x3C, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0xEC, 0xEC, 0xFE, 0xFE, 0xD6, 0xD6, 0xC6, 0xC6, 0xC6, 0xC6, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x60, 0x60,
-        0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06,
-        0x00, 0x00, 0x00, 0x00, 0x7C, 0x7C, 0x66, 0x66, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x3E, 0x3E, 0x60, 0x60, 0x3C, 0x3C, 0x06, 0x06, 0x7C, 0x7C, 0x00, 0x00,
-        0x00, 0x00, 0x18, 0x18, 0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x0E, 0x0E, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0xC6, 0xC6, 0xC6, 0xC6, 0xD6, 0xD6, 0x7C, 0x7C, 0x6C, 0x6C, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x06, 0x06, 0x7C, 0x7C,
-        0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E, 0x0C, 0x0C, 0x18, 0x18, 0x30, 0x30, 0x7E, 0x7E, 0x00, 0x00,
-        0x0E, 0x0E, 0x18, 0x18, 0x18, 0x18, 0x30, 0x30, 0x18, 0x18, 0x18, 0x18, 0x0E, 0x0E, 0x00, 0x00,
-        0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
-        0x70, 0x70, 0x18, 0x18, 0x18, 0x18, 0x0C, 0x0C, 0x18, 0x18, 0x18, 0x18, 0x70, 0x70, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0xF2, 0xF2, 0x9E, 0x9E, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    };
-    for (size_t i = 0; i < sizeof(tiles); i++) tiles[i] = ~tiles[i];
+    // Each character is a quad textured with its glyph from the atlas,
+    // submitted in batches of up to TEXT_BATCH characters
+    #define TEXT_BATCH 64
+    SDL_Vertex verts[4*TEXT_BATCH];
+    int indices[6*TEXT_BATCH];
+    SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
 
     int tile_dim = 24;
-    for (size_t i = 0; i < strlen(text); i++) {
-        char c = text[i];
-        //assert(c >= ' ' && c <= '~');
-        if (c < ' ' || c > '~') c = '.';
-        int index = c - ' ';
-        int offset = index*16;
-        u8 *tile = tiles + offset;
-        render_debug_tile(renderer, tile, col*tile_dim+i*tile_dim, row*tile_dim, tile_dim, tile_dim);
+    size_t len = strlen(text);
+    for (size_t start = 0; start < len; start += TEXT_BATCH) {
+        int count = 0;
+        for (size_t i = start; i < len && count < TEXT_BATCH; i++, count++) {
+            char c = text[i];
+            if (c < ' ' || c > '~') c = '.';
+            int index = c - ' ';
+
+            f32 x0 = (col + i)*tile_dim;
+            f32 y0 = row*tile_dim;
+            f32 x1 = x0 + tile_dim;
+            f32 y1 = y0 + tile_dim;
+            f32 u0 = (f32)index / FONT_GLYPHS;
+            f32 u1 = (f32)(index + 1) / FONT_GLYPHS;
+            SDL_Vertex *v = verts + count*4;
+            v[0] = (SDL_Vertex){{x0, y0}, white, {u0, 0.0f}};
+            v[1] = (SDL_Vertex){{x1, y0}, white, {u1, 0.0f}};
+            v[2] = (SDL_Vertex){{x1, y1}, white, {u1, 1.0f}};
+            v[3] = (SDL_Vertex){{x0, y1}, white, {u0, 1.0f}};
+
+            int *idx = indices + count*6;
+            idx[0] = count*4 + 0; idx[1] = count*4 + 1; idx[2] = count*4 + 2;
+            idx[3] = count*4 + 0; idx[4] = count*4 + 2; idx[5] = count*4 + 3;
+        }
+        SDL_RenderGeometry(renderer, font_texture, verts, count*4, indices, count*6);
     }
+    #undef TEXT_BATCH
 }
 
-static void render_debug_hw_regs(GameBoy *gb, SDL_Renderer *renderer, int w, int h)
+static void render_debug_hw_regs_text(GameBoy *gb, SDL_Renderer *renderer, int w, int h)
 {
     (void)w;
     (void)h;
@@ -368,6 +471,34 @@ static void render_debug_hw_regs(GameBoy *gb, SDL_Renderer *renderer, int w, int
     render_debug_text(renderer, text, row++, col);
 }
 
+static void render_debug_hw_regs(GameBoy *gb, SDL_Renderer *renderer, int w, int h)
+{
+    // Everything the register viewer displays
+    u64 hash = FNV1A_INIT;
+    hash = fnv1a(hash, gb->memory + 0xFF00, 0x100);
+    hash = fnv1a(hash, &gb->AF, sizeof(gb->AF));
+    hash = fnv1a(hash, &gb->BC, sizeof(gb->BC));
+    hash = fnv1a(hash, &gb->DE, sizeof(gb->DE));
+    hash = fnv1a(hash, &gb->HL, sizeof(gb->HL));
+    hash = fnv1a(hash, &gb->SP, sizeof(gb->SP));
+    hash = fnv1a(hash, &gb->PC, sizeof(gb->PC));
+    hash = fnv1a(hash, &gb->IME, sizeof(gb->IME));
+    hash = fnv1a(hash, &gb->cart_type, sizeof(gb->cart_type));
+    hash = fnv1a(hash, &gb->elapsed_cycles, sizeof(gb->elapsed_cycles));
+    hash = fnv1a(hash, gb->serial_buffer, sizeof(gb->serial_buffer));
+    Inst inst = gb_fetch(gb);
+    hash = fnv1a(hash, inst.data, inst.size);
+
+    if (debug_texture_prepare(&regs_texture, SDL_TEXTUREACCESS_TARGET, w, h, hash)) {
+        SDL_SetRenderTarget(renderer, regs_texture.texture);
+        SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
+        SDL_RenderClear(renderer);
+        render_debug_hw_regs_text(gb, renderer, w, h);
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+    SDL_RenderCopy(renderer, regs_texture.texture, NULL, NULL);
+}
+
 static void render_debug_tile_grid(SDL_Renderer *renderer, int pixel_dim, int x, int y)
 {
     if (true /*show_tile_grid*/) {
@@ -453,30 +584,36 @@ static void render_debug_viewport(GameBoy *gb, SDL_Renderer *renderer,
 
 static void render_debug_tilemap(GameBoy *gb, SDL_Renderer *renderer, int w, int h)
 {
-    int min_dim = h < w ? h : w;
-    int pixel_dim = min_dim / 256; // GameBoy pixel size
+    int pixel_dim = integer_scale(w, h, 256, 256); // GameBoy pixel size
     int x = (w - (256*pixel_dim))/2;
     int y = (h - (256*pixel_dim))/2;
-    for (int row = 0; row < 256; row++) {
-        for (int col = 0; col < 256; col++) {
-            Color color = gb->display[row*256 + col];
-            SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(color));
-            SDL_Rect r = {x+col*pixel_dim, y+row*pixel_dim, pixel_dim, pixel_dim};
-            SDL_RenderFillRect(renderer, &r);
-        }
+
+    u64 hash = fnv1a(FNV1A_INIT, gb->memory + _VRAM, 0x2000);
+    hash = fnv1a(hash, gb->memory + rLCDC, 1);
+    hash = fnv1a(hash, gb->memory + rBGP, 1);
+    if (debug_texture_prepare(&tilemap_texture, SDL_TEXTUREACCESS_STREAMING, 256, 256, hash)) {
+        static Color bg_map[256*256];
+        gb_render_bg_map(gb, bg_map);
+        SDL_UpdateTexture(tilemap_texture.texture, NULL, bg_map, 256*sizeof(Color));
     }
+    SDL_Rect dst = {x, y, 256*pixel_dim, 256*pixel_dim};
+    SDL_RenderCopy(renderer, tilemap_texture.texture, NULL, &dst);
 
     render_debug_viewport(gb, renderer, pixel_dim,
         x, y, x+255*pixel_dim, y+255*pixel_dim);
     render_debug_tile_grid(renderer, pixel_dim, x, y);
 }
 
-static void sdl_render(GameBoy *gb, SDL_Renderer *renderer)
+// Returns false if there was nothing new to present
+static bool sdl_render(SDL_Renderer *renderer)
 {
     int w, h;
     SDL_GetWindowSize(window, &w, &h);
 
     if (show_menu) {
+        if (!force_present && !vsync) return false;
+        force_present = false;
+
         SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
         SDL_RenderClear(renderer);
 
@@ -485,50 +622,55 @@ static void sdl_render(GameBoy *gb, SDL_Renderer *renderer)
         render_debug_text(renderer, "Press 'q' to exit", row++, col);
 
         SDL_RenderPresent(renderer);
-        return;
+        return true;
     }
 
     if (viewer_type == VT_GAME) {
+        // Identical frames (menus, text boxes, ...) are never published
+        const Color *frame = frame_buffer_read(&frame_buffer);
+        if (frame) {
+            SDL_UpdateTexture(game_texture, NULL, frame, SCRN_X*sizeof(Color));
+        } else if (force_present || vsync) {
+            duplicated_frames += 1;
+        } else {
+            return false;
+        }
+        presented_frames += 1;
+
         SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
         SDL_RenderClear(renderer);
 
-        int min_dim = h < w ? h : w;
-        int pixel_dim = min_dim / 160; // GameBoy pixel size
-        int x = (w - (160*pixel_dim))/2;
-        int y = (h - (144*pixel_dim))/2;
-        u16 scx = gb->memory[rSCX];
-        u16 scy = gb->memory[rSCY];
-
-        for (int row = 0; row < 144; row++) {
-            u16 px_row = (row+scy) % 256;
-            for (int col = 0; col < 160; col++) {
-                u16 px_col = (col+scx) % 256;
-                Color color = gb->display[px_row*256 + px_col];
-                SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(color));
-                SDL_Rect r = {
-                    x+col*pixel_dim, y+row*pixel_dim,
-                    pixel_dim, pixel_dim};
-                SDL_RenderFillRect(renderer, &r);
-            }
-        }
+        int pixel_dim = integer_scale(w, h, SCRN_X, SCRN_Y); // GameBoy pixel size
+        SDL_Rect dst = {
+            (w - SCRN_X*pixel_dim)/2, (h - SCRN_Y*pixel_dim)/2,
+            SCRN_X*pixel_dim, SCRN_Y*pixel_dim,
+        };
+        SDL_RenderCopy(renderer, game_texture, NULL, &dst);
     } else {
         // Debug rendering
-        if (viewer_type != VT_REGS &&
-            gb->memory[rLY] != 144 && (gb->memory[rLCDC] & LCDCF_ON) != 0) return;
+        SDL_LockMutex(debug_lock);
+        if (debug_gen == debug_gen_drawn && !force_present && !vsync) {
+            SDL_UnlockMutex(debug_lock);
+            return false;
+        }
+        debug_gen_drawn = debug_gen;
 
         SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(BG));
         SDL_RenderClear(renderer);
 
         if (viewer_type == VT_TILEMAP) {
-            render_debug_tilemap(gb, renderer, w, h);
+            render_debug_tilemap(&debug_gb, renderer, w, h);
         } else if (viewer_type == VT_TILES) {
-            render_debug_tiles(renderer, w, h, gb->memory + 0x8000);
+            render_debug_tiles(renderer, w, h, debug_gb.memory + 0x8000);
         } else if (viewer_type == VT_REGS) {
-            render_debug_hw_regs(gb, renderer, w, h);
+            render_debug_hw_regs(&debug_gb, renderer, w, h);
         }
+        SDL_UnlockMutex(debug_lock);
     }
 
+    force_present = false;
     SDL_RenderPresent(renderer);
+    return true;
 }
 
 static bool cstr_ends_with(const char *src, const char *end) {
@@ -541,6 +683,12 @@ static bool cstr_ends_with(const char *src, const char *end) {
     return true;
 }
 
+// Runs on SDL's audio thread
+static void audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    audio_ring_pop(userdata, (f32 *)stream, len / (2*sizeof(f32)));
+}
+
 static void sdl_init(void)
 {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
@@ -556,67 +704,45 @@ static void sdl_init(void)
         exit(1);
     }
 
-    renderer = SDL_CreateRenderer(window, -1, 0);
+    renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     if (!renderer) {
         fprintf(stderr, "Failed to create renderer\n");
         exit(1);
     }
 
+    // Color is RRGGBBAA, the same layout as SDL_PIXELFORMAT_RGBA8888
+    game_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_STREAMING, SCRN_X, SCRN_Y);
+    if (!game_texture) {
+        fprintf(stderr, "Failed to create texture\n");
+        exit(1);
+    }
+    font_init();
+
     SDL_AudioSpec audio_spec;
-    int sample_rate = SAMPLE_RATE;
     SDL_AudioSpec desired_spec = {
-        .freq = sample_rate,
-        .format = AUDIO_F32LSB,
-        .samples = 1024,
-        .channels = 1,
+        .freq = audio_rate,
+        .format = AUDIO_F32SYS,
+        .samples = audio_latency,
+        .channels = 2,
+        .callback = audio_callback,
+        .userdata = &audio_ring,
     };
-    device = SDL_OpenAudioDevice(NULL, 0, &desired_spec, &audio_spec, SDL_AUDIO_ALLOW_ANY_CHANGE);
+    device = SDL_OpenAudioDevice(NULL, 0, &desired_spec, &audio_spec,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
     if (!device) {
         fprintf(stderr, "Failed to open audio device\n");
         exit(1);
     }
-}
-
-static void play_square_wave(int freq, int ms, int duty_cycle)
-{
-    // 46.875 ms => How many samples ?
-    int samples_per_sweep = 2250;
-
-    // 48000 samples    => 1 s      => 1000 ms
-    //   120 samples    => 1/400 s  => 1000/400 ms
-    int samples_per_cycle = (f32)SAMPLE_RATE / (f32)freq;
-    int samples_high;
-    switch (duty_cycle) {
-        case 0:
-            samples_high = samples_per_cycle * 0.875;
-            break;
-        case 1:
-            samples_high = samples_per_cycle * 0.75;
-            break;
-        case 2:
-            samples_high = samples_per_cycle * 0.5;
-            break;
-        case 3:
-            samples_high = samples_per_cycle * 0.25;
-            break;
-        default: assert(0 && "Duty cycle mode not supported");
-    }
-
-    int sample_count = (ms*SAMPLE_RATE) / 1000;
-    assert(sample_count < 48000);
-    f32 samples[48000] = {0};
-    for (int i = 0; i < sample_count; i++) {
-        f32 sample = (i % samples_per_cycle) < samples_high ? 1.0f : 0.0f;
-        sample *= VOLUME;
-
-        int sweep_index = i / samples_per_sweep;
-        sample *= ((16.0f - sweep_index) / 16.0f);
-
-        samples[i] = sample;
-    }
-
-    SDL_QueueAudio(device, samples, sample_count * sizeof(samples[0]));
-
+    audio_freq = audio_spec.freq;
+
+    // Samples arrive one emulated frame at a time. Just before a frame arrives
+    // the ring should still hold one callback's worth, hence room for twice
+    // that plus a frame.
+    u32 frame_samples = (u32)(audio_freq * (f64)DOTS_PER_FRAME / CPU_FREQ) + 1;
+    audio_target = audio_spec.samples;
+    audio_fill_avg = audio_target;
+    audio_ring_set_latency(&audio_ring, 2*audio_spec.samples + frame_samples);
     SDL_PauseAudioDevice(device, 0);
 }
 
@@ -624,6 +750,7 @@ static void tile_viewer(const char *file_path)
 {
     size_t size;
     u8 *tile_data = read_entire_file(file_path, &size);
+    if (tile_data == NULL) return;
     printf("Tiledata size: %ld\n", size);
 
     SDL_Event e;
@@ -649,12 +776,20 @@ static void tile_viewer(const char *file_path)
     }
 }
 
-static void sdl_process_events(GameBoy *gb)
+static void set_button(u8 button, bool down)
+{
+    if (down) atomic_fetch_or(&emu_buttons, button);
+    else atomic_fetch_and(&emu_buttons, (u8)~button);
+}
+
+static void sdl_process_events(void)
 {
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
+        // Window, menu and viewer changes all need a redraw
+        force_present = true;
         if (e.type == SDL_QUIT) {
-            gb->running = false;
+            atomic_store(&emu_running, false);
         } else if (e.type == SDL_WINDOWEVENT) {
             if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
                 if (e.window.data1 < 256 || e.window.data2 < 256) {
@@ -669,7 +804,7 @@ static void sdl_process_events(GameBoy *gb)
                 }
                 break;
             case SDLK_q:
-                gb->running = false;
+                atomic_store(&emu_running, false);
                 break;
             case SDLK_g:
                 viewer_type = VT_GAME;
@@ -685,79 +820,42 @@ static void sdl_process_events(GameBoy *gb)
                 break;
             case SDLK_p:
                 if (e.key.type == SDL_KEYDOWN) {
-                    gb->paused = !gb->paused;
+                    atomic_store(&emu_paused, !atomic_load(&emu_paused));
                 }
                 break;
-            case SDLK_1:
-                if (e.key.type == SDL_KEYDOWN) play_square_wave(1048, 100, 2);
-                break;
-            case SDLK_2:
-                if (e.key.type == SDL_KEYDOWN) play_square_wave(2080, 900, 2);
-                break;
-            case SDLK_3:
-                if (e.key.type == SDL_KEYDOWN) play_square_wave(440, 100, 2);
-                break;
-            case SDLK_4:
-                if (e.key.type == SDL_KEYDOWN) play_square_wave(440, 100, 3);
+            case SDLK_TAB:
+                if (e.key.type == SDL_KEYDOWN && !e.key.repeat) {
+                    atomic_store(&fast_forward, !atomic_load(&fast_forward));
+                }
                 break;
             case SDLK_SPACE:
                 if (e.key.type == SDL_KEYDOWN) {
-                    gb_dump(gb);
-                    printf("BG tilemap $9800-$9BFF:\n");
-                    for (int row = 0; row < 32; row++) {
-                        for (int col = 0; col < 32; col++) {
-                            printf("%02X ", gb->memory[0x9800 + row*32 + col]);
-                        }
-                        printf("\n");
-                    }
-                    printf("\n");
-
-                    printf("BG tilemap $9C00-$9FFF:\n");
-                    for (int row = 0; row < 32; row++) {
-                        for (int col = 0; col < 32; col++) {
-                            printf("%02X ", gb->memory[0x9C00 + row*32 + col]);
-                        }
-                        printf("\n");
-                    }
-                    printf("\n");
-
-                    printf("OAM $FE00-$FE9F:\n");
-                    for (int i = 0; i < 40; i++) {
-                        u8 y = gb->memory[_OAMRAM + i*4 + 0] - 16;
-                        u8 x = gb->memory[_OAMRAM + i*4 + 1] - 8;
-                        u8 tile_idx = gb->memory[_OAMRAM + i*4 + 2];
-                        u8 attribs = gb->memory[_OAMRAM + i*4 + 3];
-                        printf("X: %3d, Y: %3d, Tile: %3d (%02X), Attrib: %02X\n",
-                            x, y, tile_idx, tile_idx, attribs);
-                    }
-
-                    printf("$FFA4: %02X\n", gb->memory[0xFFA4]);
-                    printf("SCX: %02X\n", gb->memory[rSCX]);
+                    atomic_store(&dump_requested, true);
                 }
                 break;
             case SDLK_s:
-                gb->button_a = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_A, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_a:
-                gb->button_b = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_B, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_RETURN:
-                gb->button_start = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_START, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_LSHIFT:
-                gb->button_select = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_SELECT, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_UP:
-                gb->dpad_up = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_UP, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_DOWN:
-                gb->dpad_down = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_DOWN, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_RIGHT:
-                gb->dpad_right = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_RIGHT, e.key.type == SDL_KEYDOWN);
                 break;
             case SDLK_LEFT:
-                gb->dpad_left = e.key.type == SDL_KEYDOWN ? 1 : 0;
+                set_button(GB_BUTTON_LEFT, e.key.type == SDL_KEYDOWN);
                 break;
 
             // Debug hotkeys
@@ -772,48 +870,241 @@ static void sdl_process_events(GameBoy *gb)
     }
 }
 
+// Runs on the emulation thread, which owns the state
+static void dump_state(GameBoy *gb)
+{
+    gb_dump(gb);
+    printf("BG tilemap $9800-$9BFF:\n");
+    for (int row = 0; row < 32; row++) {
+        for (int col = 0; col < 32; col++) {
+            printf("%02X ", gb->memory[0x9800 + row*32 + col]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    printf("BG tilemap $9C00-$9FFF:\n");
+    for (int row = 0; row < 32; row++) {
+        for (int col = 0; col < 32; col++) {
+            printf("%02X ", gb->memory[0x9C00 + row*32 + col]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    printf("OAM $FE00-$FE9F:\n");
+    for (int i = 0; i < 40; i++) {
+        u8 y = gb->memory[_OAMRAM + i*4 + 0] - 16;
+        u8 x = gb->memory[_OAMRAM + i*4 + 1] - 8;
+        u8 tile_idx = gb->memory[_OAMRAM + i*4 + 2];
+        u8 attribs = gb->memory[_OAMRAM + i*4 + 3];
+        printf("X: %3d, Y: %3d, Tile: %3d (%02X), Attrib: %02X\n",
+            x, y, tile_idx, tile_idx, attribs);
+    }
+
+    printf("$FFA4: %02X\n", gb->memory[0xFFA4]);
+    printf("SCX: %02X\n", gb->memory[rSCX]);
+}
+
+// Runs the frames behind the next published one. Only the last one is rendered,
+// the others just advance the emulation. Returns the number of frames emulated.
+static u32 emulate_frames(GameBoy *gb, Uint64 deadline)
+{
+    // Audio of the frames that are skipped is dropped
+    u32 frames = 1;
+    if (fast_forward && fast_forward_speed == SPEED_UNLIMITED) {
+        while (SDL_GetPerformanceCounter() < deadline && gb_run_frame(gb) > 0) {
+            gb_apu_read_samples(gb, NULL, BLIP_SIZE);
+            frames++;
+        }
+    } else if (fast_forward) {
+        for (; frames < fast_forward_speed; frames++) {
+            gb_run_frame(gb);
+            gb_apu_read_samples(gb, NULL, BLIP_SIZE);
+        }
+    }
+    gb_request_frame(gb);
+    gb_run_frame(gb);
+    return frames;
+}
+
+// Dynamic rate control: the emulation is paced by the frame timer while
+// the device consumes samples at its own clock. Nudging the resampling ratio
+// by up to ±0.5% keeps the ring level steady, instead of slowly draining
+// (underruns) or filling up (latency, then overruns).
+static void queue_audio(GameBoy *gb)
+{
+    static f32 samples[2*BLIP_SIZE];
+    audio_fill_avg += (audio_ring_fill(&audio_ring) - audio_fill_avg) * 0.05;
+    f64 error = (audio_target - audio_fill_avg) / audio_target;
+    gb_apu_set_rate_ratio(gb, 1.0 + APU_MAX_RATE_ADJUST*error);
+
+    size_t frames = gb_apu_read_samples(gb, samples, BLIP_SIZE);
+    for (size_t i = 0; i < 2*frames; i++) samples[i] *= VOLUME;
+    audio_ring_push(&audio_ring, samples, frames);
+}
+
+// Hands the new frame (if any) to the presenter, and a copy of the state to
+// the debug viewers when they are shown
+static void publish_frame(GameBoy *gb)
+{
+    if (gb->ppu.frame_changed) {
+        gb->ppu.frame_changed = false;
+        memcpy(frame_buffer_back(&frame_buffer), gb->display, sizeof(gb->display));
+        frame_buffer_publish(&frame_buffer);
+    }
+    if (viewer_type != VT_GAME && SDL_TryLockMutex(debug_lock) == 0) {
+        memcpy(&debug_gb, gb, sizeof(GameBoy));
+        debug_gen += 1;
+        SDL_UnlockMutex(debug_lock);
+    }
+}
+
+static int emulation_thread(void *data)
+{
+    GameBoy *gb = data;
+
+    // The LCD refreshes every DOTS_PER_FRAME cycles (~59.73 Hz). Deadlines are
+    // advanced by exactly one frame so sleep granularity does not accumulate.
+    Uint64 counter_freq = SDL_GetPerformanceFrequency();
+    Uint64 frame_ticks  = (Uint64)(counter_freq * (f64)DOTS_PER_FRAME / CPU_FREQ);
+    Uint64 deadline     = SDL_GetPerformanceCounter() + frame_ticks;
+
+    while (atomic_load(&emu_running)) {
+        gb->paused = atomic_load(&emu_paused);
+        gb_set_buttons(gb, atomic_load(&emu_buttons));
+        if (atomic_exchange(&dump_requested, false)) dump_state(gb);
+
+        atomic_fetch_add(&emulated_frames, emulate_frames(gb, deadline));
+        if (gb->status == GB_STATUS_PASSED) atomic_store(&emu_running, false); // Test ROM is done
+        queue_audio(gb);
+        publish_frame(gb);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < deadline) {
+            SDL_Delay((Uint32)((deadline - now) * 1000 / counter_freq));
+        } else if (now - deadline > 4*frame_ticks) {
+            // Too far behind (stalled host, ...): don't race to catch up
+            deadline = now;
+        }
+        deadline += frame_ticks;
+    }
+    return 0;
+}
+
+static void update_window_title(f64 speed)
+{
+    char title[64];
+    if (fast_forward) {
+        snprintf(title, sizeof(title), "GameBoy Emulator - Fast-forward %.1fx", speed);
+    } else {
+        snprintf(title, sizeof(title), "GameBoy Emulator");
+    }
+    SDL_SetWindowTitle(window, title);
+}
+
 void emulator(int argc, char **argv)
 {
-    GameBoy gb = {0};
-    gb_init_with_args(&gb, argc, argv);
-
-    Uint64 counter_freq  = SDL_GetPerformanceFrequency();
-    Uint64 start_counter = SDL_GetPerformanceCounter();
-    Uint64 prev_counter  = start_counter;
-    f64 frame_ms = 0.0;
-    while (gb.running) {
-        Uint64 curr_counter = SDL_GetPerformanceCounter();
-        Uint64 dt_counter = curr_counter - prev_counter;
-        prev_counter = curr_counter;
-        f64 dt_ms = (f64)(1000.0 * dt_counter) / counter_freq;
-        frame_ms += dt_ms;
-
-        sdl_process_events(&gb);
-
-        gb_update(&gb);
-
-        if (frame_ms >= 1.0/60.0) {
-            sdl_render(&gb, renderer);
-            frame_ms -= (1.0/60.0);
+    GameBoy gb = {0}; // Owned by the emulation thread once it starts
+    if (gb_init_with_args(&gb, argc, argv) != GB_STATUS_OK) return;
+    gb_init(&gb);
+    gb_set_render_policy(&gb, RP_ON_REQUEST, 0);
+    gb_apu_set_sample_rate(&gb, audio_freq);
+
+    frame_buffer_init(&frame_buffer);
+    debug_lock = SDL_CreateMutex();
+    atomic_store(&emu_running, true);
+    SDL_Thread *thread = SDL_CreateThread(emulation_thread, "emulation", &gb);
+    if (!debug_lock || !thread) {
+        fprintf(stderr, "Failed to start the emulation thread: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    // Achieved speed, measured over about a second
+    Uint64 counter_freq = SDL_GetPerformanceFrequency();
+    Uint64 frame_ticks  = (Uint64)(counter_freq * (f64)DOTS_PER_FRAME / CPU_FREQ);
+    Uint64 speed_start  = SDL_GetPerformanceCounter();
+    bool title_fast_forward = false;
+    while (atomic_load(&emu_running)) {
+        sdl_process_events();
+
+        // With vsync, presenting waits for the display. Without, poll for the
+        // next frame.
+        if (!sdl_render(renderer) && !vsync) SDL_Delay(1);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now - speed_start >= counter_freq || fast_forward != title_fast_forward) {
+            u32 frames = atomic_exchange(&emulated_frames, 0);
+            f64 speed = (f64)frames * frame_ticks / (f64)(now - speed_start);
+            update_window_title(speed);
+            title_fast_forward = fast_forward;
+            speed_start = now;
         }
     }
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroyMutex(debug_lock);
+
+    printf("Audio: %llu frames of underrun, %llu frames of overrun\n",
+        (unsigned long long)atomic_load(&audio_ring.underruns),
+        (unsigned long long)atomic_load(&audio_ring.overruns));
+    printf("Video: %llu frames published, %llu dropped, %llu presented, %llu duplicated\n",
+        (unsigned long long)atomic_load(&frame_buffer.published),
+        (unsigned long long)atomic_load(&frame_buffer.dropped),
+        (unsigned long long)presented_frames,
+        (unsigned long long)duplicated_frames);
 }
 
 int main(int argc, char **argv)
 {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <path to ROM>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--speed <N|max>] [--latency <samples>] [--rate <Hz>] [--vsync] <path to ROM>\n", argv[0]);
         exit(1);
     }
 
+    // Options come before the ROM path, which is always last
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc - 1) {
+            const char *value = argv[++i];
+            if (strcmp(value, "max") == 0) {
+                fast_forward_speed = SPEED_UNLIMITED;
+            } else if (atoi(value) > 0) {
+                fast_forward_speed = atoi(value);
+            } else {
+                fprintf(stderr, "Invalid speed: %s\n", value);
+                exit(1);
+            }
+            fast_forward = fast_forward_speed != 1;
+            if (fast_forward_speed == 1) fast_forward_speed = 4;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc - 1) {
+            audio_rate = atoi(argv[++i]);
+            if (audio_rate < 8000 || audio_rate > 96000) {
+                fprintf(stderr, "Invalid sample rate: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            vsync = true;
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc - 1) {
+            int samples = atoi(argv[++i]);
+            if (samples <= 0 || samples > 8192) {
+                fprintf(stderr, "Invalid latency: %s\n", argv[i]);
+                exit(1);
+            }
+            audio_latency = samples;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
     sdl_init();
 
-    if (cstr_ends_with(argv[1], ".2bpp")) {
+    const char *path = argv[argc - 1];
+    if (cstr_ends_with(path, ".2bpp")) {
         printf("Displaying tile data (.2bpp)\n");
-        tile_viewer(argv[1]);
+        tile_viewer(path);
     }
 
-    if (cstr_ends_with(argv[1], ".gb")) {
+    if (cstr_ends_with(path, ".gb")) {
         emulator(argc, argv);
     }
 
@@ -1,6 +1,8 @@
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gb.h"
 
@@ -1347,7 +1349,7 @@ void test_render_lcd_off(void)
     test_begin
     GameBoy gb = {0};
     gb_render(&gb);
-    for (size_t i = 0; i < SCRN_VX*SCRN_VY; i++) {
+    for (size_t i = 0; i < SCRN_X*SCRN_Y; i++) {
         assert(gb.display[i] == 0x00);
     }
     test_end
@@ -1370,12 +1372,456 @@ void test_render_lcd_on_bg_on(void)
     for (size_t i = 0; i < 8*8; i++) gb.memory[0x8800+i] = 0xFF;
 
     gb_render(&gb);
-    for (size_t i = 0; i < SCRN_VX*SCRN_VY; i++) {
+    for (size_t i = 0; i < SCRN_X*SCRN_Y; i++) {
         assert(gb.display[i] == PALETTE[0]);
     }
     test_end
 }
 
+void test_render_oam_scan(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_OBJON;
+
+    // 12 objects on line 0, only the first 10 (in OAM order) are selected
+    u8 xs[] = {50, 40, 30, 40, 20, 60, 70, 80, 90, 10, 5, 1};
+    for (int i = 0; i < 12; i++) {
+        gb.memory[_OAMRAM + i*4 + 0] = 16;
+        gb.memory[_OAMRAM + i*4 + 1] = xs[i];
+    }
+    // Off-screen object (line 8 and below)
+    gb.memory[_OAMRAM + 12*4 + 0] = 24;
+
+    ppu_oam_scan(&gb, 0);
+    assert(gb.ppu.line_obj_count == OBJS_PER_LINE);
+    u8 expected[] = {9, 4, 2, 1, 3, 0, 5, 6, 7, 8};
+    for (int i = 0; i < OBJS_PER_LINE; i++) {
+        assert(gb.ppu.line_objs[i] == expected[i]);
+    }
+
+    ppu_oam_scan(&gb, 8);
+    assert(gb.ppu.line_obj_count == 1);
+    assert(gb.ppu.line_objs[0] == 12);
+
+    // 8x16 objects span 16 lines
+    gb.memory[rLCDC] |= LCDCF_OBJ16;
+    ppu_oam_scan(&gb, 15);
+    assert(gb.ppu.line_obj_count == OBJS_PER_LINE);
+    ppu_oam_scan(&gb, 16);
+    assert(gb.ppu.line_obj_count == 1);
+    test_end
+}
+
+void test_render_sprite_flip(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_OBJON;
+    gb.memory[rOBP0] = 0xE4; // 11|10|01|00
+
+    // Tile 1: only the top-left pixel is set (color 3)
+    gb.memory[_VRAM8000 + 16 + 0] = 0x80;
+    gb.memory[_VRAM8000 + 16 + 1] = 0x80;
+
+    gb.memory[_OAMRAM + 0] = 16;
+    gb.memory[_OAMRAM + 1] = 8;
+    gb.memory[_OAMRAM + 2] = 1;
+    gb.memory[_OAMRAM + 3] = 0x60; // Y flip | X flip
+
+    gb_render(&gb);
+    assert(gb.display[7*SCRN_X + 7] == PALETTE[3]);
+    assert(gb.display[0] == PALETTE[0]);
+    test_end
+}
+
+void test_render_window(void)
+{
+    test_begin
+    // Same setup as test-roms/window.asm
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_BGON | LCDCF_WINON | LCDCF_WIN9C00;
+    gb.memory[rBGP] = 0xE4; // 11|10|01|00
+    gb.memory[rWY] = 40;
+    gb.memory[rWX] = 40;
+
+    // Tile 0 ($9000): color 0, tile 1 ($9010): color 3
+    for (int i = 0; i < 16; i++) gb.memory[0x9010 + i] = 0xFF;
+    // Window tilemap: tile 1 in the top-left corner only
+    gb.memory[_SCRN1] = 1;
+    // BG tilemap: tile 1 everywhere except the top-left corner
+    for (int i = 1; i < 32*32; i++) gb.memory[_SCRN0 + i] = 1;
+
+    gb_render(&gb);
+    for (int y = 0; y < SCRN_Y; y++) {
+        for (int x = 0; x < SCRN_X; x++) {
+            Color expected = PALETTE[3];
+            if (y < 8 && x < 8) expected = PALETTE[0];
+            if (y >= 40 && x >= 33) {
+                // The window uses its own line counter (starts at 0 on line WY)
+                bool corner = (y - 40) < 8 && (x - 33) < 8;
+                expected = corner ? PALETTE[3] : PALETTE[0];
+            }
+            assert(gb.display[y*SCRN_X + x] == expected);
+        }
+    }
+    assert(gb.ppu.window_line == SCRN_Y - 40);
+
+    // Scrolling moves the BG but not the window
+    gb.memory[rSCX] = 4;
+    gb.memory[rSCY] = 4;
+    gb_render(&gb);
+    assert(gb.display[3*SCRN_X + 3] == PALETTE[0]);
+    assert(gb.display[4*SCRN_X + 4] == PALETTE[3]);
+    assert(gb.display[40*SCRN_X + 33] == PALETTE[3]);
+    test_end
+}
+
+void test_render_obj_priority(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_BGON | LCDCF_OBJON | LCDCF_BG8000;
+    gb.memory[rBGP]  = 0xE4; // 11|10|01|00
+    gb.memory[rOBP0] = 0xE4;
+    gb.memory[rOBP1] = 0xFF;
+
+    // Tile 1: left half color 1 (BG) | Tile 2: solid color 2 (OBJ)
+    for (int i = 0; i < 8; i++) gb.memory[_VRAM8000 + 16 + i*2] = 0xF0;
+    for (int i = 0; i < 8; i++) gb.memory[_VRAM8000 + 32 + i*2 + 1] = 0xFF;
+    gb.memory[_SCRN0] = 1;
+
+    // Object 0: behind BG colors 1-3 | Object 1: lower priority, drawn over BG
+    gb.memory[_OAMRAM + 0] = 16;
+    gb.memory[_OAMRAM + 1] = 8;
+    gb.memory[_OAMRAM + 2] = 2;
+    gb.memory[_OAMRAM + 3] = 0x80;
+    gb.memory[_OAMRAM + 4] = 16;
+    gb.memory[_OAMRAM + 5] = 12;
+    gb.memory[_OAMRAM + 6] = 2;
+    gb.memory[_OAMRAM + 7] = 0x10;
+
+    gb_render(&gb);
+    assert(gb.display[0] == PALETTE[1]); // BG color 1 wins over object 0
+    assert(gb.display[4] == PALETTE[2]); // BG color 0, object 0 is visible
+    assert(gb.display[8] == PALETTE[3]); // Object 1 (OBP1)
+    assert(gb.display[12] == PALETTE[0]); // BG color 0 (no object)
+    test_end
+}
+
+static void run_ppu_frames(GameBoy *gb, int frames)
+{
+    for (int i = 0; i < frames; i++) ppu_tick(gb, DOTS_PER_FRAME);
+}
+
+void test_render_policy_on_request(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_BGON;
+    gb.memory[rBGP] = 0xFF; // Color index 0 => darkest shade
+    gb_set_render_policy(&gb, RP_ON_REQUEST, 0);
+    ppu_init(&gb.ppu);
+
+    // Timing still advances but no pixels are produced
+    run_ppu_frames(&gb, 2);
+    assert(gb.ppu.frame == 2);
+    for (size_t i = 0; i < SCRN_X*SCRN_Y; i++) assert(gb.display[i] == 0x00);
+
+    gb_request_frame(&gb);
+    run_ppu_frames(&gb, 2);
+    assert(!gb.ppu.render_requested);
+    for (size_t i = 0; i < SCRN_X*SCRN_Y; i++) assert(gb.display[i] == PALETTE[3]);
+    test_end
+}
+
+void test_render_frame_changed(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_BG8000 | LCDCF_BGON;
+    gb.memory[rBGP] = 0xE4;
+    ppu_init(&gb.ppu);
+
+    run_ppu_frames(&gb, 2);
+    assert(gb.ppu.frame_changed);
+
+    // Nothing written since the last frame: no line is drawn again
+    gb.ppu.frame_changed = false;
+    run_ppu_frames(&gb, 2);
+    assert(!gb.ppu.frame_changed);
+
+    gb_mem_write(&gb, 0x8000, 0xFF);   // Tile 0, row 0: color 1
+    gb_mem_write(&gb, _SCRN0 + 1, 0x01); // Tile 1 (blank) at tilemap column 1
+    run_ppu_frames(&gb, 2);
+    assert(gb.ppu.frame_changed);
+    assert(gb.display[0] == PALETTE[1]);
+    assert(gb.display[8] == PALETTE[0]);
+
+    gb.ppu.frame_changed = false;
+    gb_mem_write(&gb, rSCX, 8);
+    run_ppu_frames(&gb, 2);
+    assert(gb.ppu.frame_changed);
+    assert(gb.display[0] == PALETTE[0]);
+    test_end
+}
+
+void test_run_frame(void)
+{
+    test_begin
+    GameBoy gb = {0};
+    gb.memory[0] = 0x18; // JR -2
+    gb.memory[1] = 0xfe;
+    gb.memory[rLCDC] = LCDCF_ON | LCDCF_BGON;
+    ppu_init(&gb.ppu);
+
+    // From LCD on, the first VBlank is 144 lines away
+    u32 cycles = gb_run_frame(&gb);
+    assert(gb.ppu.frame == 1);
+    assert(gb.memory[rLY] == 144);
+    assert(cycles >= 144*DOTS_PER_SCANLINE && cycles < 144*DOTS_PER_SCANLINE + 12);
+
+    // Then one full frame per call
+    cycles = gb_run_frame(&gb);
+    assert(gb.ppu.frame == 2);
+    assert(gb.memory[rLY] == 144);
+    assert(cycles > DOTS_PER_FRAME - 12 && cycles < DOTS_PER_FRAME + 12);
+
+    // LCD off: one frame worth of cycles
+    gb_mem_write(&gb, rLCDC, LCDCF_OFF);
+    cycles = gb_run_frame(&gb);
+    assert(gb.ppu.frame == 2);
+    assert(cycles >= DOTS_PER_FRAME && cycles < DOTS_PER_FRAME + 12);
+    test_end
+}
+
+// Fixes up the logo and checksum so that gb_load_rom accepts the ROM
+static void make_rom_header(u8 *rom)
+{
+    memcpy(rom + 0x104, NINTENDO_LOGO, sizeof(NINTENDO_LOGO));
+    u8 checksum = 0;
+    for (u16 addr = 0x0134; addr <= 0x014C; addr++) checksum = checksum - rom[addr] - 1;
+    rom[0x14D] = checksum;
+}
+
+void test_status(void)
+{
+    test_begin
+    GameBoy gb = {0};
+
+    // A missing file or a bad header is reported, not fatal
+    assert(gb_load_rom_file(&gb, "./test-roms/does-not-exist.gb") == GB_STATUS_IO_ERROR);
+    static u8 rom[32*1024];
+    assert(gb_load_rom(&gb, rom, sizeof(rom)) == GB_STATUS_BAD_ROM);
+    assert(gb.rom == NULL);
+
+    make_rom_header(rom);
+    assert(gb_load_rom(&gb, rom, sizeof(rom)) == GB_STATUS_OK);
+    assert(gb.PC == 0x100 && gb.status == GB_STATUS_OK);
+    free(gb.rom);
+
+    // Serial output of a test ROM, reported when it turns the APU off
+    memset(&gb, 0, sizeof(gb));
+    strcpy(gb.serial_buffer, "01:ok\nFailed #2\n");
+    gb.serial_idx = strlen(gb.serial_buffer);
+    gb_apu_write(&gb, rNR52, 0);
+    assert(gb.status == GB_STATUS_FAILED);
+
+    memset(&gb, 0, sizeof(gb));
+    strcpy(gb.serial_buffer, "01:ok\nPassed\n");
+    gb.serial_idx = strlen(gb.serial_buffer);
+    gb_apu_write(&gb, rNR52, 0);
+    assert(gb.status == GB_STATUS_PASSED);
+
+    // An illegal opcode locks up the CPU, even with an interrupt pending
+    memset(&gb, 0, sizeof(gb));
+    gb.memory[0] = 0xD3;
+    gb_step(&gb);
+    assert(gb.status == GB_STATUS_ILLEGAL_OP);
+    gb.IME = 1;
+    gb.memory[rIE] = gb.memory[rIF] = IEF_VBLANK;
+    for (int i = 0; i < 10; i++) gb_step(&gb);
+    assert(gb.PC == 0 && gb.SP == 0);
+    test_end
+}
+
+void test_pool(void)
+{
+    test_begin
+    // MBC1: switches to ROM bank 2, writes WRAM and loops
+    static u8 rom[64*1024];
+    const u8 code[] = {
+        0x3E, 0x02,         // $0150: LD A,2
+        0xEA, 0x00, 0x20,   //        LD ($2000),A ; ROM bank 2
+        0x3E, 0x55,         //        LD A,$55
+        0xEA, 0x00, 0xC0,   //        LD ($C000),A
+        0x18, 0xFE,         //        JR @
+    };
+    memcpy(rom + 0x100, "\x00\xC3\x50\x01", 4); // NOP | JP $0150
+    memcpy(rom + 0x150, code, sizeof(code));
+    rom[0x147] = 0x01; // MBC1
+    rom[0x148] = 0x01; // 64 KiB
+    rom[2*0x4000] = 0xB2;
+    make_rom_header(rom);
+
+    GB_Pool pool;
+    assert(gb_pool_init(&pool, rom, sizeof(rom), 2, GB_POOL_HUGE_PAGES) == GB_STATUS_OK);
+    GameBoy *a = gb_pool_acquire(&pool);
+    GameBoy *b = gb_pool_acquire(&pool);
+    assert(a && b && a != b && gb_pool_acquire(&pool) == NULL);
+    assert((uintptr_t)a % GB_POOL_CACHE_LINE == 0 && (uintptr_t)b % GB_POOL_CACHE_LINE == 0);
+    assert(a->rom == pool.rom && a->PC == 0x100);
+
+    gb_request_frame(a);
+    for (int frame = 0; frame < 3; frame++) gb_run_frame(a);
+    assert(a->memory[0xC000] == 0x55 && a->memory[0x4000] == 0xB2);
+
+    // A recycled slot is back in the loaded state, only display is left as is
+    gb_pool_release(&pool, a);
+    GameBoy *c = gb_pool_acquire(&pool);
+    assert(c == a && c->elapsed_cycles == 0 && c->PC == 0x100);
+    assert(c->memory[0xC000] == 0 && c->memory[0x4000] == 0);
+    memcpy(c->display, pool.initial->display, sizeof(c->display));
+    memcpy(c->ppu.line_state, pool.initial->ppu.line_state, sizeof(c->ppu.line_state));
+    assert(memcmp(c, pool.initial, sizeof(GameBoy)) == 0);
+
+    // Resetting from a state that has rendered: lines whose inputs match its
+    // line cache must not keep the pixels of the previous run
+    GameBoy *snapshot = malloc(sizeof(GameBoy));
+    GameBoy *fresh = malloc(sizeof(GameBoy));
+    assert(snapshot && fresh);
+    gb_set_render_policy(c, RP_ALWAYS, 0);
+    gb_mem_write(c, rBGP, 0xE4);
+    for (int frame = 0; frame < 60; frame++) gb_run_frame(c);
+    memcpy(snapshot, c, sizeof(GameBoy));
+    for (u16 addr = 0x8000; addr < 0x8010; addr++) gb_mem_write(c, addr, 0xFF); // Tile 0, used by the whole BG map
+    for (int frame = 0; frame < 3; frame++) gb_run_frame(c);
+    assert(memcmp(c->display, snapshot->display, sizeof(c->display)) != 0);
+    gb_reset_from(c, snapshot);
+    memcpy(fresh, snapshot, sizeof(GameBoy));
+    gb_run_frame(c);
+    gb_run_frame(fresh);
+    assert(memcmp(c->display, fresh->display, sizeof(c->display)) == 0);
+    free(snapshot);
+    free(fresh);
+
+    gb_pool_release(&pool, b);
+    gb_pool_release(&pool, c);
+    assert(pool.free_count == 2);
+    gb_pool_free(&pool);
+    assert(pool.slots == NULL);
+    test_end
+}
+
+void test_serial_link(void)
+{
+    test_begin
+    // Sends a byte, waits for the transfer to end and stores the reply in $C000
+    static u8 roms[2][32*1024];
+    const u8 sent[2] = {0x42, 0x24};
+    const u8 clock[2] = {0x81, 0x80}; // Internal (master) | External (slave)
+    GameBoy gbs[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        const u8 code[] = {
+            0x3E, sent[i],      // $0150: LD A,sent
+            0xE0, 0x01,         //        LDH ($01),A ; SB
+            0x3E, clock[i],     //        LD A,clock
+            0xE0, 0x02,         //        LDH ($02),A ; SC
+            0xF0, 0x02,         // $0158: LDH A,($02)
+            0xCB, 0x7F,         //        BIT 7,A
+            0x20, 0xFA,         //        JR NZ,$0158
+            0xF0, 0x01,         //        LDH A,($01)
+            0xEA, 0x00, 0xC0,   //        LD ($C000),A
+            0x18, 0xFE,         //        JR @
+        };
+        memcpy(roms[i] + 0x100, "\x00\xC3\x50\x01", 4); // NOP | JP $0150
+        memcpy(roms[i] + 0x150, code, sizeof(code));
+        make_rom_header(roms[i]);
+        assert(gb_load_rom(&gbs[i], roms[i], sizeof(roms[i])) == GB_STATUS_OK);
+        gb_init(&gbs[i]);
+    }
+
+    GB_Link link;
+    gb_link_connect(&link, &gbs[0], &gbs[1], 64);
+    assert(gbs[0].link == &link && gbs[1].link == &link);
+
+    // The transfer takes 4096 cycles, the sides never drift further apart
+    gb_link_run(&link, 2048);
+    assert(gbs[0].memory[rSC] == 0xFF && gbs[1].memory[rSC] == 0xFE);
+    s64 drift = (s64)link.cycles[0] - (s64)link.cycles[1];
+    assert(drift < 64 + 24 && drift > -64 - 24);
+
+    gb_link_run(&link, 4096);
+    assert(gbs[0].memory[0xC000] == 0x24 && gbs[1].memory[0xC000] == 0x42);
+    assert(gbs[0].memory[rIF] & IEF_SERIAL && gbs[1].memory[rIF] & IEF_SERIAL);
+
+    gb_link_disconnect(&link);
+    assert(gbs[0].link == NULL && gbs[1].link == NULL);
+    for (int i = 0; i < 2; i++) free(gbs[i].rom);
+    test_end
+}
+
+void test_batch_step(void)
+{
+    test_begin
+    // Polls the d-pad into $C000 and counts iterations in B
+    static u8 rom[32*1024];
+    const u8 code[] = {
+        0x3E, 0x20,         // $0150: LD A,$20 ; Select the d-pad
+        0xE0, 0x00,         //        LDH ($00),A
+        0xF0, 0x00,         //        LDH A,($00)
+        0xEA, 0x00, 0xC0,   //        LD ($C000),A
+        0x04,               //        INC B
+        0x18, 0xF4,         //        JR $0150
+    };
+    memcpy(rom + 0x100, "\x00\xC3\x50\x01", 4); // NOP | JP $0150
+    memcpy(rom + 0x150, code, sizeof(code));
+    make_rom_header(rom);
+
+    GB_Batch batch;
+    assert(gb_batch_init(&batch, rom, sizeof(rom), 4) == GB_STATUS_OK);
+    for (u32 i = 0; i < batch.count; i++) assert(batch.envs[i].rom == batch.rom);
+
+    // Lockstep stepping ends up exactly where gb_run_frame does
+    GameBoy ref = {0};
+    assert(gb_load_rom(&ref, rom, sizeof(rom)) == GB_STATUS_OK);
+    gb_init(&ref);
+    gb_set_render_policy(&ref, RP_ON_REQUEST, 0);
+    gb_set_buttons(&ref, GB_BUTTON_LEFT);
+
+    const u8 actions[] = {0, GB_BUTTON_RIGHT, GB_BUTTON_LEFT, GB_BUTTON_UP};
+    for (int frame = 0; frame < 3; frame++) {
+        gb_batch_step(&batch, actions, batch.count);
+        gb_run_frame(&ref);
+    }
+    GameBoy *env = &batch.envs[2];
+    assert(env->elapsed_cycles == ref.elapsed_cycles && env->ppu.frame == ref.ppu.frame);
+    assert(env->AF == ref.AF && env->BC == ref.BC && env->PC == ref.PC);
+    assert(memcmp(env->memory, ref.memory, sizeof(ref.memory)) == 0);
+    free(ref.rom);
+
+    // Each instance saw its own input, and the registers are mirrored
+    assert((batch.envs[0].memory[0xC000] & 0x0F) == 0x0F);
+    assert((batch.envs[1].memory[0xC000] & 0x0F) == 0x0E);
+    assert((batch.envs[2].memory[0xC000] & 0x0F) == 0x0D);
+    assert((batch.envs[3].memory[0xC000] & 0x0F) == 0x0B);
+    for (u32 i = 0; i < batch.count; i++) {
+        assert(batch.pc[i] == batch.envs[i].PC && batch.bc[i] == batch.envs[i].BC);
+        assert(batch.status[i] == GB_STATUS_OK);
+    }
+
+    // Only the first n instances are stepped
+    u64 cycles = batch.envs[3].elapsed_cycles;
+    gb_batch_step(&batch, actions, 2);
+    assert(batch.envs[3].elapsed_cycles == cycles);
+    assert(batch.envs[0].elapsed_cycles > cycles);
+
+    gb_batch_reset(&batch, 1);
+    assert(batch.envs[1].elapsed_cycles == 0 && batch.pc[1] == 0x100);
+    gb_batch_free(&batch);
+    test_end
+}
+
 void test_cpu_instructions(void)
 {
     test_inst_nop();
@@ -1665,6 +2111,13 @@ void test_serial_transfer_data_and_control_register(void)
     gb.memory[rSB] = 0x69;
     gb_mem_write(&gb, rSC, 0x81); // Transfer Start | Internal Clock
     assert(gb.memory[rSC] == 0xFF);
+
+    // Nothing connected: after 8 bits at 8192 Hz the master reads $FF
+    gb_serial_tick(&gb, 4092);
+    assert(gb.memory[rSC] == 0xFF && gb.memory[rSB] == 0x69);
+    gb_serial_tick(&gb, 4);
+    assert(gb.memory[rSC] == 0x7F && gb.memory[rSB] == 0xFF);
+    assert(gb.memory[rIF] & IEF_SERIAL);
     test_end
 }
 
@@ -1680,17 +2133,18 @@ void test_divider_register(void)
         assert(gb.memory[rDIV] == 0);
     }
 
-    // DIV increments at a rate of 16384 Hz
+    // DIV increments at a rate of 16384 Hz (every 256 T-cycles)
     {
         GameBoy gb = {0};
-        gb.timer_div = (1000.0 / 16384.0);
-        gb_tick_ms(&gb, 0);
+        gb_timer_tick(&gb, 0);
         assert(gb.memory[rDIV] == 0);
 
-        gb_tick_ms(&gb, 1000.0 / 16384);
+        gb_timer_tick(&gb, 255);
+        assert(gb.memory[rDIV] == 0);
+        gb_timer_tick(&gb, 1);
         assert(gb.memory[rDIV] == 1);
 
-        gb_tick_ms(&gb, 10 * (1000.0 / 16384));
+        gb_timer_tick(&gb, 10*256);
         assert(gb.memory[rDIV] == 11);
     }
 
@@ -1722,40 +2176,328 @@ void test_timer_counter_register(void)
 
         gb_mem_write(&gb, rTIMA, 0);
         gb_mem_write(&gb, rTAC, 0x04); // Timer Enable at 4096 Hz
-        gb_tick_ms(&gb, 1000.0 / 4096);
+        gb_timer_tick(&gb, 1024);
         assert(gb.memory[rTIMA] == 1);
 
         gb_mem_write(&gb, rTIMA, 0);
         gb_mem_write(&gb, rTAC, 0x05); // Timer Enable at 262144 Hz
-        gb_tick_ms(&gb, 1000.0 / 262144);
+        gb_timer_tick(&gb, 16);
         assert(gb.memory[rTIMA] == 1);
 
         gb_mem_write(&gb, rTIMA, 0);
         gb_mem_write(&gb, rTAC, 0x06); // Timer Enable at 65536 Hz
-        gb_tick_ms(&gb, 1000.0 / 65536);
+        gb_timer_tick(&gb, 64);
         assert(gb.memory[rTIMA] == 1);
 
         gb_mem_write(&gb, rTIMA, 0);
         gb_mem_write(&gb, rTAC, 0x07); // Timer Enable at 16384 Hz
-        gb_tick_ms(&gb, 1000.0 / 16384);
+        gb_timer_tick(&gb, 256);
         assert(gb.memory[rTIMA] == 1);
+
+        // Many periods at once
+        gb_mem_write(&gb, rTIMA, 0);
+        gb_timer_tick(&gb, 100*256);
+        assert(gb.memory[rTIMA] == 100);
     }
 
-    // TIME is reset to the value specified in TMA on overflow
+    // TIMA is reset to the value specified in TMA on overflow, 4 cycles later
     {
         GameBoy gb = {0};
         gb_mem_write(&gb, rTAC, 0x04); // Timer Enable at 4096 Hz
 
+        gb_mem_write(&gb, rTMA, 0x42);
         gb_mem_write(&gb, rTIMA, 0xff);
         gb_mem_write(&gb, rTAC, 0x04); // Timer Enable at 4096 Hz
-        gb_tick_ms(&gb, 1000.0 / 4096);
+        assert(gb_timer_cycles_to_irq(&gb) == 1024 + 4);
+        gb_timer_tick(&gb, 1024);
         assert(gb.memory[rTIMA] == 0);
+        assert((gb.memory[rIF] & 0x04) == 0);
+
+        gb_timer_tick(&gb, 4);
+        assert(gb.memory[rTIMA] == 0x42);
+        assert(gb.memory[rIF] & 0x04);
+
+        // Overflows keep reloading from TMA
+        gb.memory[rIF] = 0;
+        gb_timer_tick(&gb, (0x100 - 0x42)*1024);
+        assert(gb.memory[rTIMA] == 0x42);
         assert(gb.memory[rIF] & 0x04);
+    }
+
+    // Resetting DIV while the selected bit is set is a falling edge
+    {
+        GameBoy gb = {0};
+        gb_mem_write(&gb, rTAC, 0x05); // Timer Enable at 262144 Hz (bit 3)
+        gb_timer_tick(&gb, 8);
+        assert(gb.memory[rTIMA] == 0);
+        gb_mem_write(&gb, rDIV, 0);
+        assert(gb.memory[rTIMA] == 1);
+
+        // Disabling the timer while the selected bit is set too
+        gb_timer_tick(&gb, 8);
+        gb_mem_write(&gb, rTAC, 0x01);
+        assert(gb.memory[rTIMA] == 2);
+    }
+    test_end
+}
+
+void test_audio_registers(void)
+{
+    test_begin
+    // Power: the registers are only writable while the APU is on
+    {
+        GameBoy gb = {0};
+        gb_mem_write(&gb, rNR50, 0x77);
+        assert(gb.memory[rNR50] == 0x00);
+        gb_mem_write(&gb, rNR52, 0x80);
+        assert(gb.memory[rNR52] == 0xF0);
+        gb_mem_write(&gb, rNR50, 0x77);
+        assert(gb.memory[rNR50] == 0x77);
+
+        gb_mem_write(&gb, rNR52, 0x00);
+        assert(gb.memory[rNR50] == 0x00);
+        assert(gb.memory[rNR52] == 0x70);
+    }
+
+    // Length timer and DAC
+    {
+        GameBoy gb = {0};
+        gb_mem_write(&gb, rNR52, 0x80);
+        gb_mem_write(&gb, rNR22, 0xF0);
+        gb_mem_write(&gb, rNR21, 0x3F); // Length 1
+        gb_mem_write(&gb, rNR24, 0xC0); // Trigger with length enabled
+        assert(gb.memory[rNR52] == 0xF2);
+        gb_apu_tick(&gb, APU_FRAME_SEQ_CYCLES - 1);
+        assert(gb.memory[rNR52] == 0xF2);
+        gb_apu_tick(&gb, 1);
+        assert(gb.memory[rNR52] == 0xF0);
+
+        gb_mem_write(&gb, rNR24, 0x80);
+        assert(gb.memory[rNR52] == 0xF2);
+        gb_mem_write(&gb, rNR22, 0x00); // DAC off
+        assert(gb.memory[rNR52] == 0xF0);
+        gb_mem_write(&gb, rNR24, 0x80);
+        assert(gb.memory[rNR52] == 0xF0);
+    }
+
+    // Sweep: frequency written back to NR13/NR14, overflow stops channel 1
+    {
+        GameBoy gb = {0};
+        gb_mem_write(&gb, rNR52, 0x80);
+        gb_mem_write(&gb, rNR10, 0x11); // Pace 1, increase, shift 1
+        gb_mem_write(&gb, rNR12, 0xF0);
+        gb_mem_write(&gb, rNR13, 0x00);
+        gb_mem_write(&gb, rNR14, 0x85); // Frequency $500
+        assert(gb.memory[rNR52] == 0xF1);
 
+        gb_apu_tick(&gb, 3*APU_FRAME_SEQ_CYCLES); // Steps 0, 1 and 2
+        assert(gb.memory[rNR13] == 0x80);
+        assert((gb.memory[rNR14] & 7) == 0x07); // $780
+        assert(gb.memory[rNR52] == 0xF0);      // $780 + $3C0 overflows
+
+        gb_mem_write(&gb, rNR13, 0xFF);
+        gb_mem_write(&gb, rNR14, 0x87);
+        assert(gb.memory[rNR52] == 0xF0);
+    }
+
+    // Envelope and noise
+    {
+        GameBoy gb = {0};
+        gb_mem_write(&gb, rNR52, 0x80);
+        gb_mem_write(&gb, rNR42, 0x19); // Volume 1, increase, pace 1
+        gb_mem_write(&gb, rNR43, 0x00); // Divisor 8, 15-bit LFSR
+        gb_mem_write(&gb, rNR44, 0x80);
+        assert(gb.apu.ch[3].lfsr == 0x7FFF);
+        gb_apu_tick(&gb, 8);
+        assert(gb.apu.ch[3].lfsr == 0x3FFF);
+
+        assert(gb.apu.ch[3].volume == 1);
+        gb_apu_tick(&gb, 8*APU_FRAME_SEQ_CYCLES - 8);
+        assert(gb.apu.ch[3].volume == 2);
     }
     test_end
 }
 
+void test_apu_output(void)
+{
+    test_begin
+    static f32 samples[2*BLIP_SIZE];
+    GameBoy gb = {0};
+    gb_apu_set_sample_rate(&gb, 48000);
+    gb_mem_write(&gb, rNR52, 0x80);
+    gb_mem_write(&gb, rNR50, 0x77);
+    gb_mem_write(&gb, rNR51, 0x22); // Channel 2 on both sides
+    gb_mem_write(&gb, rNR21, 0x80); // 50% duty
+    gb_mem_write(&gb, rNR22, 0xF0);
+    gb_mem_write(&gb, rNR23, 1750 & 0xFF);
+    gb_mem_write(&gb, rNR24, 0x80 | (1750 >> 8)); // ~440 Hz
+
+    // One frame worth of samples at 48 kHz
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    size_t n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    assert(n == 803);
+    f32 lo = 1.0f, hi = -1.0f;
+    for (size_t i = 0; i < n; i++) {
+        assert(samples[2*i] == samples[2*i + 1]);
+        assert(fabsf(samples[2*i]) < 0.35f);
+        if (samples[2*i] < lo) lo = samples[2*i];
+        if (samples[2*i] > hi) hi = samples[2*i];
+    }
+    assert(hi - lo > 0.2f);
+
+    // Panned left: the right side only decays to silence
+    gb_mem_write(&gb, rNR51, 0x20);
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    for (size_t i = BLIP_WIDTH + 1; i < n; i++) {
+        assert(fabsf(samples[2*i + 1]) <= fabsf(samples[2*(i - 1) + 1]));
+    }
+
+    // Rate control: at most 0.5% more samples
+    gb_apu_set_rate_ratio(&gb, 2.0);
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    assert(n == 807 || n == 808);
+    gb_apu_set_rate_ratio(&gb, 0.995);
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    assert(n == 799 || n == 800);
+
+    // Nobody reading: the buffer keeps the most recent samples only
+    for (int i = 0; i < 100; i++) gb_apu_tick(&gb, DOTS_PER_FRAME);
+    n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    assert(n > 0 && n < BLIP_SIZE);
+
+    // The sample rate can be changed at any time
+    gb_apu_set_sample_rate(&gb, 44100);
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    assert(gb_apu_read_samples(&gb, samples, BLIP_SIZE) == 738);
+    gb_apu_set_sample_rate(&gb, 96000);
+    gb_apu_tick(&gb, DOTS_PER_FRAME);
+    assert(gb_apu_read_samples(&gb, samples, BLIP_SIZE) == 1607);
+    test_end
+}
+
+void test_apu_lazy_sync(void)
+{
+    test_begin
+    static f32 samples[2*BLIP_SIZE];
+    GameBoy gb = {0};
+    gb.memory[0] = 0x18; // JR -2
+    gb.memory[1] = 0xfe;
+    gb_apu_set_sample_rate(&gb, 48000);
+    gb_mem_write(&gb, rNR52, 0x80);
+    gb_mem_write(&gb, rNR50, 0x77);
+    gb_mem_write(&gb, rNR51, 0x22);
+    gb_mem_write(&gb, rNR21, 0x80);
+    gb_mem_write(&gb, rNR22, 0xF0);
+    gb_mem_write(&gb, rNR24, 0x87);
+
+    // Without register writes the APU only runs when the samples are read
+    gb_run_frame(&gb);
+    assert(gb.apu.synced == 0);
+    size_t n = gb_apu_read_samples(&gb, samples, BLIP_SIZE);
+    assert(gb.apu.synced == gb.elapsed_cycles);
+    assert(n == 803 || n == 804);
+
+    // A length timer that can stop the channel forces a sync to keep NR52 current
+    u64 start = gb.elapsed_cycles;
+    gb_mem_write(&gb, rNR21, 0xBF); // Length 1
+    gb_mem_write(&gb, rNR24, 0xC7);
+    assert(gb.memory[rNR52] & 0x02);
+    while ((gb.memory[rNR52] & 0x02) && gb.elapsed_cycles - start < DOTS_PER_FRAME) gb_step(&gb);
+    assert((gb.memory[rNR52] & 0x02) == 0);
+    assert(gb.elapsed_cycles - start <= APU_FRAME_SEQ_CYCLES + 12);
+    test_end
+}
+
+void test_audio_ring(void)
+{
+    test_begin
+    static Audio_Ring ring;
+    f32 in[2*300], out[2*300];
+    for (int i = 0; i < 2*300; i++) in[i] = (f32)i;
+    audio_ring_set_latency(&ring, 256);
+
+    // Overrun: only up to the latency is queued
+    assert(audio_ring_push(&ring, in, 300) == 256);
+    assert(audio_ring_fill(&ring) == 256);
+    assert(ring.overruns == 44);
+
+    assert(audio_ring_pop(&ring, out, 100) == 100);
+    for (int i = 0; i < 2*100; i++) assert(out[i] == in[i]);
+    assert(audio_ring_fill(&ring) == 156);
+
+    // Underrun: the missing frames are silence
+    assert(audio_ring_pop(&ring, out, 200) == 156);
+    for (int i = 0; i < 2*156; i++) assert(out[i] == in[2*100 + i]);
+    for (int i = 2*156; i < 2*200; i++) assert(out[i] == 0.0f);
+    assert(ring.underruns == 44);
+
+    // Wrap around the end of the buffer
+    audio_ring_set_latency(&ring, AUDIO_RING_SIZE);
+    for (int i = 0; i < 100; i++) {
+        assert(audio_ring_push(&ring, in, 300) == 300);
+        assert(audio_ring_pop(&ring, out, 300) == 300);
+        assert(out[0] == in[0] && out[2*299 + 1] == in[2*299 + 1]);
+    }
+    assert(ring.underruns == 44 && ring.overruns == 44);
+    test_end
+}
+
+static void *frame_buffer_producer(void *arg)
+{
+    Frame_Buffer *fb = arg;
+    for (Color seq = 1; seq <= 2000; seq++) {
+        Color *back = frame_buffer_back(fb);
+        for (int i = 0; i < SCRN_X*SCRN_Y; i++) back[i] = seq;
+        frame_buffer_publish(fb);
+    }
+    return NULL;
+}
+
+void test_frame_buffer(void)
+{
+    test_begin
+    static Frame_Buffer fb;
+    frame_buffer_init(&fb);
+    assert(frame_buffer_read(&fb) == NULL);
+
+    frame_buffer_back(&fb)[0] = 1;
+    frame_buffer_publish(&fb);
+    const Color *front = frame_buffer_read(&fb);
+    assert(front && front[0] == 1);
+    assert(frame_buffer_read(&fb) == NULL);
+
+    // The reader only ever gets the newest frame, the other one is dropped
+    frame_buffer_back(&fb)[0] = 2;
+    frame_buffer_publish(&fb);
+    assert(frame_buffer_back(&fb) != front); // Never drawn over while being read
+    frame_buffer_back(&fb)[0] = 3;
+    frame_buffer_publish(&fb);
+    front = frame_buffer_read(&fb);
+    assert(front && front[0] == 3);
+    assert(fb.published == 3 && fb.dropped == 1);
+
+    // Concurrently, frames arrive whole and in order
+    frame_buffer_init(&fb);
+    pthread_t producer;
+    pthread_create(&producer, NULL, frame_buffer_producer, &fb);
+    Color last = 0;
+    u64 reads = 0;
+    while (last < 2000) {
+        front = frame_buffer_read(&fb);
+        if (front == NULL) continue;
+        for (int i = 1; i < SCRN_X*SCRN_Y; i++) assert(front[i] == front[0]);
+        assert(front[0] > last);
+        last = front[0];
+        reads += 1;
+    }
+    pthread_join(producer, NULL);
+    assert(fb.published == 2000 && fb.dropped == 2000 - reads);
+    test_end
+}
+
 void test_lcd_control_register(void)
 {
     test_begin
@@ -1931,51 +2673,97 @@ void test_lcd_status_register(void)
     // Mode 2 (OAM scan)
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(0));
-        //assert((gb.memory[rSTAT] & 3) == PM_OAM);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 0);
+        assert((gb.memory[rSTAT] & 3) == PM_OAM);
     }
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(79));
-        //assert(gb.ppu.dot == 79);
-        //assert((gb.memory[rSTAT] & 3) == 2);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 79);
+        assert(gb.ppu.dot == 79);
+        assert((gb.memory[rSTAT] & 3) == 2);
     }
 
     // Mode 3 (Transfer to LCD)
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(80));
-        //assert(gb.ppu.dot == 80);
-        //assert((gb.memory[rSTAT] & 3) == 3);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 80);
+        assert(gb.ppu.dot == 80);
+        assert((gb.memory[rSTAT] & 3) == 3);
     }
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(251));
-        //assert(gb.ppu.dot == 251);
-        //assert((gb.memory[rSTAT] & 3) == 3);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 251);
+        assert(gb.ppu.dot == 251);
+        assert((gb.memory[rSTAT] & 3) == 3);
     }
 
     // Mode 0 (HBlank)
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(252));
-        //assert(gb.ppu.dot == 252);
-        //assert((gb.memory[rSTAT] & 3) == 0);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 252);
+        assert(gb.ppu.dot == 252);
+        assert((gb.memory[rSTAT] & 3) == 0);
     }
     {
         GameBoy gb = {0};
-        gb_tick_ms(&gb, DOTS_TO_MS(DOTS_PER_SCANLINE - 1));
-        //assert(gb.ppu.dot == DOTS_PER_SCANLINE - 1);
-        //assert((gb.memory[rSTAT] & 3) == 0);
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, DOTS_PER_SCANLINE - 1);
+        assert(gb.ppu.dot == DOTS_PER_SCANLINE - 1);
+        assert((gb.memory[rSTAT] & 3) == 0);
+        ppu_tick(&gb, 1);
+        assert(gb.memory[rLY] == 1);
+        assert((gb.memory[rSTAT] & 3) == 2);
     }
 
     // Mode 1 (VBlank)
     {
         GameBoy gb = {0};
         gb.memory[rLCDC] = LCDCF_ON;
-        gb_tick_ms(&gb, DOTS_TO_MS(144*DOTS_PER_SCANLINE));
-        //assert(gb.ppu.dot == 144*DOTS_PER_SCANLINE);
-        //assert((gb.memory[rSTAT] & 3) == 1);
+        ppu_tick(&gb, 144*DOTS_PER_SCANLINE - 1);
+        assert((gb.memory[rIF] & IEF_VBLANK) == 0);
+        ppu_tick(&gb, 1);
+        assert(gb.memory[rLY] == 144 && gb.ppu.dot == 0);
+        assert((gb.memory[rSTAT] & 3) == 1);
+        assert(gb.memory[rIF] & IEF_VBLANK);
+
+        ppu_tick(&gb, 10*DOTS_PER_SCANLINE);
+        assert(gb.memory[rLY] == 0);
+        assert((gb.memory[rSTAT] & 3) == 2);
+        assert(gb.ppu.frame == 1);
+    }
+
+    // STAT interrupt on LYC=LY and on the selected modes
+    {
+        GameBoy gb = {0};
+        gb.memory[rLCDC] = LCDCF_ON;
+        gb_mem_write(&gb, rLYC, 2);
+        gb_mem_write(&gb, rSTAT, STATF_LYC);
+        ppu_tick(&gb, 2*DOTS_PER_SCANLINE - 1);
+        assert((gb.memory[rIF] & IEF_STAT) == 0);
+        ppu_tick(&gb, 1);
+        assert(gb.memory[rSTAT] & STATF_LYCF);
+        assert(gb.memory[rIF] & IEF_STAT);
+
+        gb.memory[rIF] = 0;
+        gb_mem_write(&gb, rSTAT, STATF_MODE00);
+        ppu_tick(&gb, 252);
+        assert(gb.memory[rIF] & IEF_STAT);
+    }
+
+    // LCD off: LY = 0, mode 0
+    {
+        GameBoy gb = {0};
+        gb.memory[rLCDC] = LCDCF_ON;
+        ppu_tick(&gb, 10*DOTS_PER_SCANLINE + 100);
+        gb_mem_write(&gb, rLCDC, LCDCF_OFF);
+        ppu_tick(&gb, 100);
+        assert(gb.memory[rLY] == 0);
+        assert((gb.memory[rSTAT] & 3) == 0);
     }
 
     test_end
@@ -2144,6 +2932,7 @@ void test_disassemble(void)
     size_t size;
     //u8 *rom = read_entire_file("./test-roms/unbricked.gb", &size);
     u8 *rom = read_entire_file("./test-roms/blargg/cpu_instrs/cpu_instrs.gb", &size);
+    assert(rom != NULL);
     assert(size <= 0x10000);
     printf("\n");
     gb_disassemble(rom, size);
@@ -2723,6 +3512,62 @@ void test_assemble_inst(void)
     test_end
 }
 
+// Runs a program that keeps retriggering channel 2 with the LCD and the timer
+// on, and hashes the audio, the screen and the final CPU state
+static void *run_instance(void *arg)
+{
+    static const u8 program[] = {
+        0x3E, 0x80, 0xE0, 0x26, // LD A,$80; LDH (NR52),A
+        0x3E, 0x77, 0xE0, 0x24, // LD A,$77; LDH (NR50),A
+        0x3E, 0xFF, 0xE0, 0x25, // LD A,$FF; LDH (NR51),A
+        0x3E, 0xF0, 0xE0, 0x17, // LD A,$F0; LDH (NR22),A
+        0x04, 0x78, 0xE0, 0x18, // INC B; LD A,B; LDH (NR23),A
+        0x3E, 0x87, 0xE0, 0x19, // LD A,$87; LDH (NR24),A
+        0x18, 0xF6,             // JR $10
+    };
+    GameBoy *gb = calloc(1, sizeof(GameBoy));
+    f32 *samples = malloc(2*BLIP_SIZE * sizeof(f32));
+    memcpy(gb->memory, program, sizeof(program));
+    gb->memory[0x8000] = 0xFF;
+    gb->memory[rBGP] = 0xE4;
+    gb->memory[rLCDC] = LCDCF_ON | LCDCF_BG8000 | LCDCF_BGON;
+    gb->memory[rTAC] = TACF_START | TACF_262KHZ;
+    gb_init(gb);
+    gb_apu_set_sample_rate(gb, 48000);
+
+    u64 hash = 0xCBF29CE484222325ull;
+    for (int frame = 0; frame < 30; frame++) {
+        gb_run_frame(gb);
+        size_t n = gb_apu_read_samples(gb, samples, BLIP_SIZE);
+        const u8 *bytes = (const u8 *)samples;
+        for (size_t i = 0; i < n*2*sizeof(f32); i++) hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        const u8 *pixels = (const u8 *)gb->display;
+        for (size_t i = 0; i < sizeof(gb->display); i++) hash = (hash ^ pixels[i]) * 0x100000001B3ull;
+    }
+    hash ^= ((u64)gb->B << 32) | ((u64)gb->memory[rTIMA] << 16) | gb->PC;
+
+    free(samples);
+    free(gb);
+    *(u64 *)arg = hash;
+    return NULL;
+}
+
+void test_multiple_instances(void)
+{
+    test_begin
+    // Instances running on their own threads must not affect each other
+    u64 expected;
+    run_instance(&expected);
+
+    enum { THREADS = 8 };
+    pthread_t threads[THREADS];
+    u64 hashes[THREADS];
+    for (int i = 0; i < THREADS; i++) pthread_create(&threads[i], NULL, run_instance, &hashes[i]);
+    for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+    for (int i = 0; i < THREADS; i++) assert(hashes[i] == expected);
+    test_end
+}
+
 int main(void)
 {
     test_fetch();
@@ -2731,6 +3576,18 @@ int main(void)
 
     test_render_lcd_off();
     test_render_lcd_on_bg_on();
+    test_render_oam_scan();
+    test_render_sprite_flip();
+    test_render_window();
+    test_render_obj_priority();
+    test_render_policy_on_request();
+    test_render_frame_changed();
+    test_run_frame();
+    test_status();
+    test_batch_step();
+    test_pool();
+    test_serial_link();
+    test_multiple_instances();
 
     test_interrupts();
 
@@ -2742,7 +3599,11 @@ int main(void)
     //test_timer_modulo_register();
     //test_timer_control_register();
     //test_interrupt_flag_register();
-    //test_audio_registers(); // NR10 - NR52, Wave RAM
+    test_audio_registers(); // NR10 - NR52, Wave RAM
+    test_apu_output();
+    test_apu_lazy_sync();
+    test_audio_ring();
+    test_frame_buffer();
     test_lcd_control_register();
     test_lcd_status_register();
     //test_viewport_y_register();
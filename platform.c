@@ -1,27 +1,32 @@
+#include <sys/mman.h>
+
+// Returns NULL (after logging why) if the file cannot be read
 uint8_t *read_entire_file(const char *path, size_t *size)
 {
     FILE *f = fopen(path, "rb");
     if (f == NULL) {
         fprintf(stderr, "Failed to open %s\n", path);
-        exit(1);
+        return NULL;
     }
-    if (fseek(f, 0, SEEK_END) < 0) {
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) file_size = ftell(f);
+    if (file_size <= 0) {
         fprintf(stderr, "Failed to read file %s\n", path);
-        exit(1);
+        fclose(f);
+        return NULL;
     }
 
-    long file_size = ftell(f);
-    assert(file_size > 0);
-
     rewind(f);
 
     uint8_t *file_data = malloc(file_size);
     assert(file_data);
 
     size_t bytes_read = fread(file_data, 1, file_size, f);
+    fclose(f);
     if (bytes_read != (size_t)file_size) {
         fprintf(stderr, "Could not read entire file\n");
-        exit(1);
+        free(file_data);
+        return NULL;
     }
 
     if (size != NULL) {
@@ -29,3 +34,35 @@ uint8_t *read_entire_file(const char *path, size_t *size)
     }
     return file_data;
 }
+
+// Zeroed, page-aligned memory straight from the OS. With huge set, explicit
+// huge pages are tried first, then transparent huge pages are requested for
+// a regular mapping. *got_huge tells whether explicit huge pages were used.
+#define PLATFORM_HUGE_PAGE_SIZE (2*1024*1024)
+
+void *platform_alloc_pages(size_t size, bool huge, bool *got_huge)
+{
+    *got_huge = false;
+#ifdef MAP_HUGETLB
+    if (huge) {
+        size_t huge_size = (size + PLATFORM_HUGE_PAGE_SIZE - 1) & ~(size_t)(PLATFORM_HUGE_PAGE_SIZE - 1);
+        void *ptr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            *got_huge = true;
+            return ptr;
+        }
+    }
+#endif
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (huge) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+void platform_free_pages(void *ptr, size_t size, bool huge)
+{
+    if (huge) size = (size + PLATFORM_HUGE_PAGE_SIZE - 1) & ~(size_t)(PLATFORM_HUGE_PAGE_SIZE - 1);
+    munmap(ptr, size);
+}
@@ -121,10 +121,12 @@ static bool running;
 static ui_ctx_t ui_ctx;
 static SDL_Window *window;
 static SDL_Renderer *renderer;
+static SDL_Texture *font_texture; // Glyph atlas: 96 8x8 glyphs side by side
 
 f32 clamp(f32 in, f32 min, f32 max);
 f32 remap(f32 in, f32 in_min, f32 in_max, f32 out_min, f32 out_max);
 
+void ui_font_init(void);
 void ui_clear(Color color);
 void ui_present(void);
 void ui_viewport(f32 x, f32 y, f32 w, f32 h);
@@ -155,6 +157,7 @@ int main(int argc, char **argv)
     SDL_Init(SDL_INIT_VIDEO);
     ui_ctx.win_rect = (ui_rect_t){0.0, 0.0, WIDTH, HEIGHT};
     SDL_CreateWindowAndRenderer(WIDTH, HEIGHT, SDL_WINDOW_RESIZABLE, &window, &renderer);
+    ui_font_init();
 
     running = true;
     ui_ctx.mouse_x = -1;
@@ -274,6 +277,30 @@ int main(int argc, char **argv)
     return 0;
 }
 
+// Builds the glyph atlas once: glyph pixels are opaque white, the rest is
+// transparent, so text can be tinted with the vertex color.
+void ui_font_init(void)
+{
+    static Color pixels[96*8*8];
+    for (int glyph = 0; glyph < 96; glyph++) {
+        const u8 *tile = font_tiles + glyph*16;
+        for (int row = 0; row < 8; row++) {
+            u8 lo_bitplane = tile[row*2 + 0];
+            u8 hi_bitplane = tile[row*2 + 1];
+            for (int col = 0; col < 8; col++) {
+                u8 bit0 = (lo_bitplane >> (7 - col)) & 1;
+                u8 bit1 = (hi_bitplane >> (7 - col)) & 1;
+                pixels[row*96*8 + glyph*8 + col] = (bit0 | bit1) ? WHITE : 0;
+            }
+        }
+    }
+
+    font_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 96*8, 8);
+    assert(font_texture);
+    SDL_UpdateTexture(font_texture, NULL, pixels, 96*8*sizeof(Color));
+    SDL_SetTextureBlendMode(font_texture, SDL_BLENDMODE_BLEND);
+}
+
 void ui_clear(Color color)
 {
     SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(color));
@@ -418,32 +445,33 @@ ui_rect_t ui_text(f32 x, f32 y, Color color, const char *text, u32 pixel_scale,
     if (norm_y > max_y) max_y = norm_y;
     if (!display) return (ui_rect_t){min_x, min_y, max_x - min_x, max_y - min_y};
 
-    for (size_t i = 0; i < len; i++) {
-        char c = text[i];
-        if (c < ' ' || c > '~') c = '.';
-        int index = c - ' ';
-        const u8 *tile = font_tiles + index*16;
-
-        for (int row = 0; row < 8; row++) {
-            u8 lo_bitplane = tile[row*2 + 0];
-            u8 hi_bitplane = tile[row*2 + 1];
-            for (int col = 0; col < 8; col++) {
-                u8 bit0 = (lo_bitplane & 0x80) >> 7;
-                u8 bit1 = (hi_bitplane & 0x80) >> 7;
-                lo_bitplane <<= 1;
-                hi_bitplane <<= 1;
-
-                int px_x = x + 8*i*pixel_scale + col*pixel_scale;
-                int px_y = y + row*pixel_scale;
-
-                u8 color_idx = (bit1 << 1) | bit0;
-                if (display && color_idx != 0) {
-                    SDL_SetRenderDrawColor(renderer, HEX_TO_COLOR(color));
-                    SDL_Rect r = { px_x, px_y, pixel_scale, pixel_scale };
-                    SDL_RenderFillRect(renderer, &r);
-                }
-            }
+    // One textured quad per character, submitted in batches
+    SDL_Vertex verts[4*64];
+    int indices[6*64];
+    SDL_Color tint = {HEX_TO_COLOR(color)};
+    f32 glyph_dim = 8*pixel_scale;
+    for (size_t start = 0; start < len; start += 64) {
+        int count = 0;
+        for (size_t i = start; i < len && count < 64; i++, count++) {
+            char c = text[i];
+            if (c < ' ' || c > '~') c = '.';
+            int index = c - ' ';
+
+            f32 x0 = (int)x + i*glyph_dim;
+            f32 y0 = (int)y;
+            f32 u0 = index/96.0f;
+            f32 u1 = (index + 1)/96.0f;
+            SDL_Vertex *v = verts + count*4;
+            v[0] = (SDL_Vertex){{x0, y0}, tint, {u0, 0.0f}};
+            v[1] = (SDL_Vertex){{x0 + glyph_dim, y0}, tint, {u1, 0.0f}};
+            v[2] = (SDL_Vertex){{x0 + glyph_dim, y0 + glyph_dim}, tint, {u1, 1.0f}};
+            v[3] = (SDL_Vertex){{x0, y0 + glyph_dim}, tint, {u0, 1.0f}};
+
+            int *idx = indices + count*6;
+            idx[0] = count*4 + 0; idx[1] = count*4 + 1; idx[2] = count*4 + 2;
+            idx[3] = count*4 + 0; idx[4] = count*4 + 2; idx[5] = count*4 + 3;
         }
+        SDL_RenderGeometry(renderer, font_texture, verts, count*4, indices, count*6);
     }
 
     return (ui_rect_t){min_x, min_y, max_x - min_x, max_y - min_y};